@@ -0,0 +1,467 @@
+#include "shell.h"
+#include <fcntl.h>
+#include <spawn.h>
+
+// Microbenchmarks for the shell's internal hot paths. Links against every
+// object file except main.o and times each path in isolation, printing one
+// JSON document on stdout:
+//
+//   {"benchmarks": [{"name": ..., "iterations": ..., "ns_per_op": ...}, ...]}
+//
+// Each benchmark is run with a growing iteration count until one batch
+// takes at least BENCH_MIN_SECONDS, and that batch is reported.
+//
+// Usage: shell-bench [name-prefix]
+
+#define BENCH_MIN_SECONDS 0.2
+
+typedef struct benchmark {
+    const char *name;
+    void (*setup)(void);
+    void (*run)(long iterations);
+    void (*teardown)(void);
+} benchmark_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Keeps results alive so the compiler can't drop the work
+static volatile size_t sink;
+
+static const char *sample_line =
+    "grep -n --color=auto pattern src/shell_core.c src/parser.c include/shell.h";
+
+// split_line
+
+static void run_split_line(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        char *line = strdup(sample_line);
+        char **args = split_line(line);
+        sink += (size_t)args[0];
+        free_args(args);
+        free(line);
+    }
+}
+
+// Variable expansion
+
+static void setup_expand(void) {
+    set_shell_var("PROJECT", "myshell");
+    set_shell_var("BUILD", "release");
+}
+
+static void teardown_expand(void) {
+    unset_shell_var("PROJECT");
+    unset_shell_var("BUILD");
+}
+
+// expand_words over the words of a line, split once in setup
+static char **expand_input;
+
+static void split_expand_input(const char *text) {
+    char *line = strdup(text);
+    expand_input = split_line(line);
+    free(line);
+}
+
+static void setup_short_line(void) {
+    setup_expand();
+    split_expand_input("building $PROJECT in ${BUILD} mode for $USER");
+}
+
+// A 1 MB line with tens of thousands of references
+#define LONG_LINE_SIZE (1 << 20)
+
+static void setup_long_line(void) {
+    setup_expand();
+    static const char chunk[] = "text ${PROJECT} more text $BUILD/$USER $? ";
+    char *long_line = malloc(LONG_LINE_SIZE + 1);
+    size_t len = 0;
+    while (len + sizeof(chunk) - 1 <= LONG_LINE_SIZE) {
+        memcpy(long_line + len, chunk, sizeof(chunk) - 1);
+        len += sizeof(chunk) - 1;
+    }
+    long_line[len] = '\0';
+    split_expand_input(long_line);
+    free(long_line);
+}
+
+static void teardown_expand_input(void) {
+    teardown_expand();
+    free_args(expand_input);
+    expand_input = NULL;
+}
+
+static void run_expand_words(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        char **fields = expand_words(expand_input);
+        sink += (size_t)fields[0];
+        free_args(fields);
+    }
+}
+
+static void run_expand_word(long iterations) {
+    const char *word = "\"building $PROJECT in ${BUILD} mode for $USER\"";
+    for (long i = 0; i < iterations; i++) {
+        char *result = expand_word(word);
+        sink += result[0];
+        free(result);
+    }
+}
+
+// Parsing
+
+static void run_parse(long iterations) {
+    const char *line =
+        "cat access.log | grep -v health > out.txt && sort out.txt | uniq -c; "
+        "echo \"done: $?\" || { echo failed; exit 1; }";
+    for (long i = 0; i < iterations; i++) {
+        int status;
+        parse_tree_t *tree = parse_command_line(line, &status);
+        sink += (size_t)tree->root;
+        free_parse_tree(tree);
+    }
+}
+
+// Variable and alias lookup at different table sizes
+
+static long table_size;
+
+static void fill_tables(long size) {
+    char name[32];
+    for (long i = 0; i < size; i++) {
+        snprintf(name, sizeof(name), "NAME_%ld", i);
+        set_shell_var(name, "value");
+        add_alias(name, "value");
+    }
+    table_size = size;
+}
+
+static void clear_tables(void) {
+    char name[32];
+    for (long i = 0; i < table_size; i++) {
+        snprintf(name, sizeof(name), "NAME_%ld", i);
+        unset_shell_var(name);
+        remove_alias(name);
+    }
+    table_size = 0;
+}
+
+static void setup_tables_10(void) { fill_tables(10); }
+static void setup_tables_1k(void) { fill_tables(1000); }
+static void setup_tables_100k(void) { fill_tables(100000); }
+
+// Hits spread over the whole table
+static void run_get_shell_var(long iterations) {
+    char name[32];
+    for (long i = 0; i < iterations; i++) {
+        snprintf(name, sizeof(name), "NAME_%ld", (i * 7919) % table_size);
+        sink += (size_t)get_shell_var(name);
+    }
+}
+
+static void run_get_alias(long iterations) {
+    char name[32];
+    for (long i = 0; i < iterations; i++) {
+        snprintf(name, sizeof(name), "NAME_%ld", (i * 7919) % table_size);
+        sink += (size_t)get_alias(name);
+    }
+}
+
+// Assigning an exported variable with a large environment: only its own
+// envp slot changes
+
+static void setup_exported_1k(void) {
+    char name[32];
+    for (long i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "NAME_%ld", i);
+        export_shell_var(name, "value");
+    }
+    table_size = 1000;
+}
+
+static void run_export(long iterations) {
+    char name[32];
+    for (long i = 0; i < iterations; i++) {
+        snprintf(name, sizeof(name), "NAME_%ld", (i * 7919) % table_size);
+        export_shell_var(name, (i & 1) ? "one" : "two");
+        sink += (size_t)shell_envp()[0];
+    }
+}
+
+// History at capacity
+
+static void setup_history(void) {
+    history_set_size(DEFAULT_HISTSIZE);
+    for (int i = 0; i < DEFAULT_HISTSIZE; i++) {
+        add_to_history("warm-up entry");
+    }
+}
+
+static void teardown_history(void) {
+    free_history();
+}
+
+static void run_add_to_history(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        add_to_history((char *)sample_line);
+    }
+}
+
+// Incremental search over a large history: a query that only matches old
+// entries, as each keystroke of Ctrl-R would issue it
+
+#define SEARCH_HISTORY_SIZE 100000
+
+static void setup_search(void) {
+    char line[128];
+    history_set_size(SEARCH_HISTORY_SIZE);
+    for (int i = 0; i < SEARCH_HISTORY_SIZE; i++) {
+        snprintf(line, sizeof(line), "git commit -m 'change %d' && make -j%d test", i, i % 16);
+        add_to_history(line);
+    }
+}
+
+static void run_history_search(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        sink += history_search("change 123'", history.base + history.count);
+    }
+}
+
+// A very large directory, for file name completion (after the first Tab
+// has cached its listing) and for globbing
+
+#define BIG_DIR_FILES 200000
+
+static char big_dir[32];
+
+static void setup_big_dir(void) {
+    char path[64];
+    strcpy(big_dir, "/tmp/shell-bench-XXXXXX");
+    if (!mkdtemp(big_dir)) {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < BIG_DIR_FILES; i++) {
+        snprintf(path, sizeof(path), "%s/file%06d", big_dir, i);
+        close(open(path, O_CREAT | O_WRONLY, 0644));
+    }
+}
+
+static void teardown_big_dir(void) {
+    char path[64];
+    for (int i = 0; i < BIG_DIR_FILES; i++) {
+        snprintf(path, sizeof(path), "%s/file%06d", big_dir, i);
+        unlink(path);
+    }
+    rmdir(big_dir);
+}
+
+static void run_complete_word(long iterations) {
+    char word[64];
+    snprintf(word, sizeof(word), "%s/file12345", big_dir);
+    for (long i = 0; i < iterations; i++) {
+        int count;
+        char **matches = complete_word(word, 0, &count);
+        for (int j = 0; j < count; j++) free(matches[j]);
+        free(matches);
+        sink += count;
+    }
+}
+
+static void run_glob(long iterations) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "%s/file1234*", big_dir);
+    for (long i = 0; i < iterations; i++) {
+        int count;
+        char **matches = glob_pattern(pattern, &count);
+        for (int j = 0; j < count; j++) free(matches[j]);
+        free(matches);
+        sink += count;
+    }
+}
+
+// Running an external command: spawn, exec and wait
+
+static void run_execute_command(long iterations) {
+    char *args[] = { "true", NULL };
+    for (long i = 0; i < iterations; i++) {
+        execute_command(args);
+    }
+}
+
+// Here-documents: parsed once, then turned into a readable descriptor on
+// each run, through a pipe (1KB) or a memfd (1MB)
+
+static parse_tree_t *heredoc_tree;
+
+static void setup_heredoc(size_t size) {
+    static const char line[] = "server_name example.org; listen 443 ssl;\n";
+    char *text = malloc(size + 32);
+    size_t len = sprintf(text, "cat <<'EOF'\n");
+    while (len + sizeof(line) - 1 <= size) {
+        memcpy(text + len, line, sizeof(line) - 1);
+        len += sizeof(line) - 1;
+    }
+    strcpy(text + len, "EOF");
+
+    int status;
+    heredoc_tree = parse_command_line(text, &status);
+    free(text);
+}
+
+static void setup_heredoc_1k(void) { setup_heredoc(1024); }
+static void setup_heredoc_1m(void) { setup_heredoc(1024 * 1024); }
+
+static void teardown_heredoc(void) {
+    free_parse_tree(heredoc_tree);
+}
+
+static void run_heredoc(long iterations) {
+    char *input_file, *output_file;
+    int input_fd, append;
+    fd_redirects_t fd_redirects;
+    for (long i = 0; i < iterations; i++) {
+        expand_redirects(heredoc_tree->root->redirects, &input_file, &input_fd,
+                         &output_file, &append, &fd_redirects);
+        sink += input_fd;
+        close(input_fd);
+    }
+}
+
+// Arithmetic: one cached expression, and a counting loop of 1000
+// iterations run entirely in the shell
+
+static parse_tree_t *loop_tree;
+
+static void run_arith_evaluate(long iterations) {
+    long long value;
+    for (long i = 0; i < iterations; i++) {
+        arith_evaluate("n = (n + 3) * 7 % 1000", &value);
+        sink += value;
+    }
+}
+
+static void setup_loop(void) {
+    int status;
+    loop_tree = parse_command_line("let i=0; while let \"i < 1000\"; do let i++; done", &status);
+}
+
+static void teardown_loop(void) {
+    free_parse_tree(loop_tree);
+    unset_shell_var("i");
+    unset_shell_var("n");
+}
+
+static void run_loop(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        execute_node(loop_tree->root);
+    }
+}
+
+// Command substitution: a pure builtin captured in process, and the same
+// output from a forked subshell (cd is not pure)
+
+static void run_substitution(const char *code, long iterations) {
+    size_t len;
+    for (long i = 0; i < iterations; i++) {
+        char *output = command_substitution(code, &len);
+        sink += len;
+        free(output);
+    }
+}
+
+static void run_substitution_builtin(long iterations) {
+    run_substitution("echo hello", iterations);
+}
+
+static void run_substitution_subshell(long iterations) {
+    run_substitution("cd .; echo hello", iterations);
+}
+
+// Startup: exec of the shell binary to its first command. The command is
+// `exit`, so this is the whole life of a non-interactive shell. The binary
+// is $SHELL_BENCH_BINARY, or ./shell.
+
+static void run_startup(long iterations) {
+    char *binary = getenv("SHELL_BENCH_BINARY");
+    if (!binary) binary = "./shell";
+    char *args[] = { binary, "-c", "exit", NULL };
+
+    for (long i = 0; i < iterations; i++) {
+        pid_t pid;
+        if (posix_spawn(&pid, binary, NULL, NULL, args, environ) != 0) {
+            perror(binary);
+            exit(EXIT_FAILURE);
+        }
+        waitpid(pid, NULL, 0);
+    }
+}
+
+static const benchmark_t benchmarks[] = {
+    { "split_line", NULL, run_split_line, NULL },
+    { "expand_words", setup_short_line, run_expand_words, teardown_expand_input },
+    { "expand_words/1MB", setup_long_line, run_expand_words, teardown_expand_input },
+    { "expand_word", setup_expand, run_expand_word, teardown_expand },
+    { "parse_command_line", NULL, run_parse, NULL },
+    { "get_shell_var/10", setup_tables_10, run_get_shell_var, clear_tables },
+    { "get_shell_var/1k", setup_tables_1k, run_get_shell_var, clear_tables },
+    { "get_shell_var/100k", setup_tables_100k, run_get_shell_var, clear_tables },
+    { "get_alias/10", setup_tables_10, run_get_alias, clear_tables },
+    { "get_alias/1k", setup_tables_1k, run_get_alias, clear_tables },
+    { "get_alias/100k", setup_tables_100k, run_get_alias, clear_tables },
+    { "export/1k-exported", setup_exported_1k, run_export, clear_tables },
+    { "add_to_history/full", setup_history, run_add_to_history, teardown_history },
+    { "history_search/100k", setup_search, run_history_search, teardown_history },
+    { "complete_word/200k-files", setup_big_dir, run_complete_word, teardown_big_dir },
+    { "glob/200k-files", setup_big_dir, run_glob, teardown_big_dir },
+    { "execute_command/true", NULL, run_execute_command, NULL },
+    { "arith_evaluate", NULL, run_arith_evaluate, NULL },
+    { "while_let/1000", setup_loop, run_loop, teardown_loop },
+    { "here_document/1KB", setup_heredoc_1k, run_heredoc, teardown_heredoc },
+    { "here_document/1MB", setup_heredoc_1m, run_heredoc, teardown_heredoc },
+    { "command_substitution/builtin", NULL, run_substitution_builtin, NULL },
+    { "command_substitution/subshell", NULL, run_substitution_subshell, NULL },
+    { "startup/-c", NULL, run_startup, NULL },
+};
+
+int main(int argc, char *argv[]) {
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    size_t count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    int first = 1;
+
+    // The variable store owns the environment once anything is exported,
+    // so import it the way the shell does; otherwise PATH goes missing
+    init_shell();
+
+    printf("{\"benchmarks\": [");
+    for (size_t b = 0; b < count; b++) {
+        const benchmark_t *bench = &benchmarks[b];
+        if (filter && strncmp(bench->name, filter, strlen(filter)) != 0) continue;
+
+        if (bench->setup) bench->setup();
+
+        long iterations = 1;
+        double elapsed;
+        for (;;) {
+            double start = now_seconds();
+            bench->run(iterations);
+            elapsed = now_seconds() - start;
+            if (elapsed >= BENCH_MIN_SECONDS) break;
+            iterations *= elapsed > 0.02 ? 2 : 10;
+        }
+
+        if (bench->teardown) bench->teardown();
+
+        printf("%s\n  {\"name\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f}",
+               first ? "" : ",", bench->name, iterations,
+               elapsed * 1e9 / iterations, iterations / elapsed);
+        fflush(stdout);
+        first = 0;
+    }
+    printf("\n]}\n");
+    return 0;
+}
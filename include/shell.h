@@ -16,18 +16,17 @@
 #include <errno.h>
 #include <pwd.h>
 #include <time.h>
-#include <glob.h>
 #include <signal.h>
 #include <termios.h>
+#include <sys/resource.h>
+#include <poll.h>
 #include <ctype.h>
 
 // Constants
 #define MAX_LINE 1024
 #define MAX_ARGS 64
-#define MAX_HISTORY 1000
+#define DEFAULT_HISTSIZE 1000
 #define MAX_JOBS 100
-#define MAX_ALIASES 100
-#define MAX_VARS 100
 
 // Color codes
 #define COLOR_RESET   "\033[0m"
@@ -46,46 +45,196 @@ typedef enum {
     JOB_DONE
 } job_status_t;
 
-// Job structure
-typedef struct job {
-    int id;
+// One process of a job
+typedef struct job_process {
     pid_t pid;
+    job_status_t status;
+    int exit_status;        // shell-style status ($?) once done
+} job_process_t;
+
+// Job structure: every process of a pipeline, in one process group
+typedef struct job {
+    int id;                 // 0 until the job is put in the job table
+    pid_t pgid;
+    job_process_t *procs;
+    int nprocs;
     char *command;
     job_status_t status;
+    int foreground;         // owns the terminal; the shell is waiting on it
+    unsigned long timing;   // `time` run that started the job, or 0
     struct job *next;
+    struct job *prev;
 } job_t;
 
-// Alias structure
-typedef struct alias {
-    char *name;
-    char *value;
-} alias_t;
+// Parsed command lines (see src/parser.c)
+typedef enum {
+    NODE_COMMAND,           // simple command: words and redirections
+    NODE_PIPELINE,          // children[0] | children[1] | ...
+    NODE_AND,               // left && right
+    NODE_OR,                // left || right
+    NODE_SEQUENCE,          // left ; right
+    NODE_BACKGROUND,        // left &
+    NODE_GROUP,             // { left }
+    NODE_FUNCTION,          // words[0] () left
+    NODE_TIME,              // time left (left may be NULL)
+    NODE_WHILE,             // while left; do right; done
+    NODE_UNTIL              // until left; do right; done
+} node_type_t;
+
+typedef enum {
+    REDIR_INPUT,            // < file
+    REDIR_OUTPUT,           // > file
+    REDIR_APPEND,           // >> file
+    REDIR_HEREDOC,          // << word or <<- word
+    REDIR_HERESTRING        // <<< word
+} redirect_type_t;
+
+typedef struct redirect {
+    redirect_type_t type;
+    int fd;                 // descriptor redirected: 0 for input, 1 for output,
+                            // or the number written before the operator
+    char *target;           // word as written, expanded at execution;
+                            // for a here-document, its delimiter
+    char *body;             // REDIR_HEREDOC: the lines before the delimiter
+    int quoted;             // REDIR_HEREDOC: delimiter was quoted, body is literal
+    struct redirect *next;
+} redirect_t;
+
+typedef struct node {
+    node_type_t type;
+    char **words;           // NODE_COMMAND: words as written, NULL-terminated
+    redirect_t *redirects;  // NODE_COMMAND
+    struct node **children; // NODE_PIPELINE: stages
+    int nchildren;
+    struct node *left;
+    struct node *right;
+    struct parse_tree *tree;    // NODE_FUNCTION: tree owning the body
+} node_t;
+
+typedef struct parse_tree {
+    struct arena_block *arena;  // every node and word lives here
+    node_t *root;               // NULL for an empty line
+    int refs;
+} parse_tree_t;
+
+// parse_command_line status
+#define PARSE_OK 0
+#define PARSE_INCOMPLETE 1      // input ended inside a construct
+#define PARSE_ERROR 2
+
+// process_complex_command result when the line needs more input
+#define COMMAND_INCOMPLETE -1
+
+// Open-addressing hash table (see src/hash_table.c)
+typedef struct hash_entry {
+    char *key;
+    void *value;
+    unsigned int hash;
+} hash_entry_t;
+
+typedef struct hash_table {
+    hash_entry_t *entries;
+    size_t capacity;
+    size_t count;           // live entries
+    size_t used;            // live entries plus tombstones
+} hash_table_t;
+
+// Command history: a ring of the most recent HISTSIZE entries. Entries are
+// numbered from 1 for the life of the shell; the ring holds numbers
+// base .. base + count - 1.
+typedef struct history_ring {
+    char **entries;
+    int capacity;
+    int start;              // slot holding the oldest entry
+    int count;
+    long base;              // number of the oldest entry
+} history_ring_t;
 
-// Environment variable structure
-typedef struct shell_var {
-    char *name;
-    char *value;
-} shell_var_t;
+// Redirections of descriptors other than stdin to a file and stdout to a
+// file, such as 2>errors or 3<<EOF: each places a file, or an already open
+// descriptor, on fd. A later redirection of the same fd replaces an earlier.
+#define MAX_REDIRECT_FD 9           // 10 and up are the shell's own
+
+typedef struct fd_redirect {
+    int fd;
+    char *file;             // file to open, or NULL to use source
+    int flags;              // open(2) flags for file
+    int source;             // open descriptor, such as a here-document's
+} fd_redirect_t;
+
+typedef struct fd_redirects {
+    int count;
+    fd_redirect_t list[MAX_REDIRECT_FD + 1];
+} fd_redirects_t;
+
+// Process launch request (see src/spawn.c)
+typedef struct spawn_req {
+    char **argv;
+    int in_fd;              // fd to place on stdin, or -1
+    int out_fd;             // fd to place on stdout, or -1
+    const char *in_file;    // file to open on stdin, or NULL
+    const char *out_file;   // file to open on stdout, or NULL
+    int append;
+    const fd_redirects_t *fd_redirects;     // other descriptors, or NULL
+    int (*shell_fn)(void *arg);  // run in a forked child instead of exec;
+    void *shell_arg;             // its return value is the exit status
+    const int *close_fds;   // extra fds the forked child must close
+    int nclose;
+    job_t *job;             // job the process joins, or NULL
+} spawn_req_t;
+
+// Builtin command registration (see src/builtin_commands.c)
+#define BUILTIN_PURE 0x1            // touches no shell state; only writes output
+#define BUILTIN_KEEPS_STATUS 0x2    // sees $? from the previous command
+
+typedef struct builtin {
+    const char *name;
+    int (*handler)(char **args);    // returns 0 to make the shell exit
+    int flags;
+    const char *usage;              // for help; NULL hides the entry
+    const char *description;
+} builtin_t;
+
+// Shell function (see src/functions.c)
+typedef struct shell_function shell_function_t;
 
 // Global variables
 extern char **environ;
 extern job_t *job_list;
-extern alias_t aliases[MAX_ALIASES];
-extern shell_var_t shell_vars[MAX_VARS];
-extern char *history[MAX_HISTORY];
-extern int history_count;
-extern int alias_count;
-extern int var_count;
+extern hash_table_t alias_table;
+extern hash_table_t var_table;
+extern history_ring_t history;
+extern int last_exit_status;    // status of the most recent command ($?)
+extern int exit_requested;      // set once the exit builtin has run
+extern int job_control;         // interactive: jobs get process groups and the terminal
+extern pid_t shell_pid;         // $$
+extern pid_t last_background_pid;   // $!, or 0 before the first background job
+extern int return_requested;    // set by return until the function unwinds
+extern char *shell_name;        // $0
+extern char **positional_params;    // $1, $2, ... NULL-terminated
 
 // Core functions
 void init_shell(void);
+void init_interactive(void);
 void cleanup_shell(void);
-char *read_line(void);
+char *read_line(const char *prompt);
 char **split_line(char *line);
 int execute_command(char **args);
-void display_prompt(void);
+
+// Completion
+void completion_prefetch(void);
+char **complete_word(const char *word, int command_position, int *count);
+void free_completion(void);
+
+// Prompt
+const char *render_prompt(void);
+void redraw_prompt(void);
+void prompt_invalidate(void);
 
 // Built-in commands
+extern const builtin_t builtins[];
+extern const size_t builtin_count;
+const builtin_t *find_builtin(const char *name);
 int cmd_cd(char **args);
 int cmd_pwd(char **args);
 int cmd_exit(char **args);
@@ -95,30 +244,117 @@ int cmd_jobs(char **args);
 int cmd_fg(char **args);
 int cmd_bg(char **args);
 int cmd_kill(char **args);
+int cmd_parallel(char **args);
+int cmd_bench(char **args);
 int cmd_export(char **args);
 int cmd_unset(char **args);
 int cmd_alias(char **args);
 int cmd_unalias(char **args);
 int cmd_echo(char **args);
 int cmd_type(char **args);
+int cmd_hash(char **args);
+int cmd_return(char **args);
+int cmd_source(char **args);
+int cmd_let(char **args);
 
 // Advanced features
 int process_complex_command(char *line);
-int handle_pipes(char **commands, int num_commands);
-int handle_redirection(char **args, char *input_file, char *output_file, int append);
-char *expand_wildcards(char *pattern);
-char *expand_variables(char *str);
+int handle_pipes(node_t *pipeline, int background);
+int handle_redirection(char **args, char *input_file, int input_fd, char *output_file, int append,
+                       const fd_redirects_t *fd_redirects);
 int run_script(char *filename);
+int run_string(const char *commands);
+
+// Hash tables
+void hash_table_init(hash_table_t *table);
+void *hash_table_get(const hash_table_t *table, const char *key);
+void *hash_table_put(hash_table_t *table, const char *key, void *value);
+void *hash_table_remove(hash_table_t *table, const char *key);
+int hash_table_next(const hash_table_t *table, size_t *pos,
+                    const char **key, void **value);
+void hash_table_clear(hash_table_t *table, void (*free_value)(void *));
+
+// Command lookup
+const char *find_command(const char *name);
+void hash_forget_command(const char *name);
+void hash_invalidate(void);
+
+// Process spawning
+void spawn_req_init(spawn_req_t *req, char **argv);
+pid_t spawn_process(const spawn_req_t *req);
+int open_redirect_files(const spawn_req_t *req, int *in_fd, int *out_fd);
+int open_fd_redirects(const fd_redirects_t *redirs, int *fds);
+void close_fd_redirects(const fd_redirects_t *redirs, int *fds);
+int open_pipe(int fds[2]);
+
+// Parsing and execution
+parse_tree_t *parse_command_line(const char *line, int *status);
+const char *skip_substitution(const char *s);
+void retain_parse_tree(parse_tree_t *tree);
+void free_parse_tree(parse_tree_t *tree);
+int execute_node(node_t *node);
+int run_node_in_child(void *node);
+int run_command_in_child(void *args);
+char *node_text(node_t *node);
+int expand_redirects(redirect_t *redir, char **input_file, int *input_fd, char **output_file, int *append,
+                     fd_redirects_t *fd_redirects);
+void free_fd_redirects(fd_redirects_t *fd_redirects);
+char **expand_words(char **words);
+int expansion_assigns(const char *word);
+char *expand_word(const char *word);
+char *expand_here_document(const char *body);
+char **glob_pattern(const char *pattern, int *count);
+char *command_substitution(const char *code, size_t *len);
+
+// Arithmetic (see src/arithmetic.c)
+int arith_evaluate(const char *text, long long *result);
+void free_arithmetic(void);
+
+// Functions and scripts
+void define_function(node_t *def);
+shell_function_t *find_function(const char *name);
+node_t *function_body(shell_function_t *fn);
+const char *next_function_name(size_t *pos);
+int call_function(shell_function_t *fn, char **args);
+int source_file(const char *path, char **params);
+void set_positional_params(char *name, char **params);
+const char *get_positional_param(int n);
+void free_functions(void);
 
 // Job control
-void add_job(pid_t pid, char *command);
-void remove_job(pid_t pid);
+void init_job_control(void);
+void enable_job_control(void);
+int job_event_fd(void);
+job_t *create_job(const char *command, int foreground);
+void job_add_process(job_t *job, pid_t pid);
+int wait_for_job(job_t *job);
+pid_t wait_for_job_process(job_t *job, int *exit_status);
+void release_job(job_t *job);
+void background_job(job_t *job);
+int run_in_foreground(spawn_req_t *req, const char *command);
+int continue_job(job_t *job, int foreground);
+int signal_job(job_t *job, int sig);
+void reap_children(void);
 void update_job_status(void);
 job_t *find_job(int id);
 job_t *find_job_by_pid(pid_t pid);
+job_t *parse_job_spec(const char *spec);
+int job_count(void);
+void free_jobs(void);
+
+// Timing
+unsigned long current_timing(void);
+void account_child_usage(unsigned long timing, const struct rusage *usage);
+int execute_timed(node_t *node);
 
 // History
 void add_to_history(char *line);
+char *history_get(long number);
+void history_set_size(int size);
+void free_history(void);
+void history_index_add(long number, const char *entry);
+void history_index_clear(void);
+long history_search(const char *query, long before);
 void save_history(void);
 void load_history(void);
 
@@ -129,12 +365,19 @@ void remove_alias(char *name);
 
 // Variables
 void set_shell_var(char *name, char *value);
+void export_shell_var(char *name, char *value);
 char *get_shell_var(char *name);
 void unset_shell_var(char *name);
+char **shell_envp(void);
+void free_shell_vars(void);
 
 // Utilities
 char *trim_whitespace(char *str);
 int is_builtin(char *command);
+int compare_strings(const void *a, const void *b);
+char *str_replace(const char *orig, const char *rep, const char *with);
+char *join_words(char **words);
+int copy_fd(int in_fd, int out_fd);
 void free_args(char **args);
 
 #endif
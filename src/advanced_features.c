@@ -1,392 +1,383 @@
 #include "shell.h"
 
+// Run a line typed at the prompt. Once the command is complete, however
+// many lines it took, it goes into history as one entry before it runs.
 int process_complex_command(char *line) {
-    // Handle empty line
-    if (strlen(trim_whitespace(line)) == 0) {
+    int status;
+    parse_tree_t *tree = parse_command_line(line, &status);
+    
+    if (!tree && status == PARSE_INCOMPLETE) {
+        return COMMAND_INCOMPLETE;  // caller reads more lines
+    }
+    if (*line) {
+        add_to_history(line);
+    }
+    if (!tree) {
+        last_exit_status = 2;
         return 1;
     }
     
-    // Expand variables first
-    char *expanded_line = expand_variables(line);
+    execute_node(tree->root);
+    free_parse_tree(tree);
     
-    // Check for background process
-    int background = 0;
-    char *line_copy = strdup(expanded_line);
-    int len = strlen(line_copy);
-    if (len > 0 && line_copy[len-1] == '&') {
-        background = 1;
-        line_copy[len-1] = '\0';
-        line_copy = trim_whitespace(line_copy);
-    }
-    
-    // Split by command separators (&&, ||, ;)
-    char *commands[MAX_ARGS];
-    int cmd_count = 0;
-    char *separators[MAX_ARGS];
-    int sep_count = 0;
+    return !exit_requested;
+}
+
+// A pipeline stage, expanded before anything is launched
+typedef struct pipe_stage {
+    node_t *node;
+    char **args;            // NULL for groups and other shell code
+    char *in_file;
+    int in_fd;              // here-document or here-string, or -1
+    char *out_file;
+    int append;
+    fd_redirects_t fd_redirects;
+} pipe_stage_t;
+
+// `cat` with nothing but file operands, as opposed to options or stdin
+static int is_plain_cat(const pipe_stage_t *stage) {
+    char **args = stage->args;
+    if (!args || !args[0] || strcmp(args[0], "cat") != 0) return 0;
+    if (stage->fd_redirects.count) return 0;
+    if (find_function("cat") || get_alias("cat")) return 0;
     
-    char *current = line_copy;
-    char *start = current;
+    for (int i = 1; args[i]; i++) {
+        if (args[i][0] == '-') return 0;
+    }
+    return 1;
+}
+
+static int is_readable_file(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, R_OK) == 0;
+}
+
+// Stands in for `cat file...` at the head of a pipeline
+static int cat_files_to_stdout(void *arg) {
+    char **paths = arg;
+    int status = 0;
     
-    while (*current) {
-        if (strncmp(current, "&&", 2) == 0) {
-            *current = '\0';
-            commands[cmd_count++] = trim_whitespace(start);
-            separators[sep_count++] = "&&";
-            current += 2;
-            start = current;
-        } else if (strncmp(current, "||", 2) == 0) {
-            *current = '\0';
-            commands[cmd_count++] = trim_whitespace(start);
-            separators[sep_count++] = "||";
-            current += 2;
-            start = current;
-        } else if (*current == ';') {
-            *current = '\0';
-            commands[cmd_count++] = trim_whitespace(start);
-            separators[sep_count++] = ";";
-            current++;
-            start = current;
-        } else {
-            current++;
+    for (int i = 0; paths[i]; i++) {
+        int fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || copy_fd(fd, STDOUT_FILENO) == -1) {
+            fprintf(stderr, "cat: %s: %s\n", paths[i], strerror(errno));
+            status = 1;
         }
+        if (fd != -1) close(fd);
     }
-    commands[cmd_count++] = trim_whitespace(start);
-    
-    // Execute command chain
-    int last_status = 1;
-    for (int i = 0; i < cmd_count; i++) {
-        if (i > 0) {
-            // Check separator condition
-            if (strcmp(separators[i-1], "&&") == 0 && last_status == 0) {
-                break;  // Previous command failed
-            } else if (strcmp(separators[i-1], "||") == 0 && last_status != 0) {
-                break;  // Previous command succeeded
-            }
+    return status;
+}
+
+// Take plain file copies out of the pipeline. `cat file | cmd` becomes
+// `cmd < file` and `cmd | cat > file` becomes `cmd > file`, so the data
+// never passes through a pipe or an extra process. A head `cat` of several
+// files is kept as a stage but runs in the shell as a sendfile loop instead
+// of exec'ing cat. Returns the range of stages still to launch.
+static void elide_copy_stages(pipe_stage_t *stages, int *first, int *last) {
+    pipe_stage_t *head = &stages[*first];
+    if (*last > *first && is_plain_cat(head) && !head->out_file &&
+        !stages[*first + 1].in_file && stages[*first + 1].in_fd == -1) {
+        char **files = head->args + 1;
+        int nfiles = 0;
+        int readable = 1;
+        while (files[nfiles]) {
+            readable = readable && is_readable_file(files[nfiles]);
+            nfiles++;
         }
         
-        // Check for pipes in this command
-        if (strchr(commands[i], '|')) {
-            char *pipe_commands[MAX_ARGS];
-            int pipe_count = 0;
-            
-            char *cmd_copy = strdup(commands[i]);
-            char *token = strtok(cmd_copy, "|");
-            while (token && pipe_count < MAX_ARGS - 1) {
-                pipe_commands[pipe_count++] = trim_whitespace(token);
-                token = strtok(NULL, "|");
-            }
-            
-            last_status = handle_pipes(pipe_commands, pipe_count);
-            free(cmd_copy);
-        } else {
-            // Single command, check for redirection
-            char *input_file = NULL;
-            char *output_file = NULL;
-            int append = 0;
-            
-            char *cmd_copy = strdup(commands[i]);
-            char **args = split_line(cmd_copy);
-            
-            // Parse redirection
-            int arg_count = 0;
-            while (args[arg_count]) {
-                if (strcmp(args[arg_count], "<") == 0 && args[arg_count + 1]) {
-                    input_file = args[arg_count + 1];
-                    // Remove redirection from args
-                    free(args[arg_count]);
-                    free(args[arg_count + 1]);
-                    args[arg_count] = NULL;
-                    break;
-                } else if (strcmp(args[arg_count], ">") == 0 && args[arg_count + 1]) {
-                    output_file = args[arg_count + 1];
-                    append = 0;
-                    free(args[arg_count]);
-                    free(args[arg_count + 1]);
-                    args[arg_count] = NULL;
-                    break;
-                } else if (strcmp(args[arg_count], ">>") == 0 && args[arg_count + 1]) {
-                    output_file = args[arg_count + 1];
-                    append = 1;
-                    free(args[arg_count]);
-                    free(args[arg_count + 1]);
-                    args[arg_count] = NULL;
-                    break;
-                }
-                arg_count++;
-            }
-            
-            if (background) {
-                pid_t pid = fork();
-                if (pid == 0) {
-                    // Child process
-                    if (input_file || output_file) {
-                        handle_redirection(args, input_file, output_file, append);
-                        exit(EXIT_SUCCESS);
-                    } else {
-                        if (execvp(args[0], args) == -1) {
-                            printf("%s: command not found\n", args[0]);
-                            exit(EXIT_FAILURE);
-                        }
-                    }
-                } else if (pid > 0) {
-                    // Parent process
-                    add_job(pid, commands[i]);
-                    printf("[%d] %d\n", 1, pid);
-                } else {
-                    perror("fork");
-                }
-            } else {
-                // Foreground execution
-                if (input_file || output_file) {
-                    last_status = handle_redirection(args, input_file, output_file, append);
-                } else {
-                    last_status = execute_command(args);
-                }
-            }
-            
-            free(cmd_copy);
-            free_args(args);
+        if (nfiles == 0 && head->in_file && is_readable_file(head->in_file)) {
+            stages[*first + 1].in_file = head->in_file;
+            head->in_file = NULL;
+            (*first)++;
+        } else if (nfiles == 0 && head->in_fd != -1) {
+            // cat <<EOF | cmd: cmd reads the here-document itself
+            stages[*first + 1].in_fd = head->in_fd;
+            head->in_fd = -1;
+            (*first)++;
+        } else if (nfiles == 1 && !head->in_file && readable) {
+            stages[*first + 1].in_file = strdup(files[0]);
+            (*first)++;
         }
     }
     
-    free(line_copy);
-    if (expanded_line != line) {
-        free(expanded_line);
+    pipe_stage_t *tail = &stages[*last];
+    if (*last > *first && is_plain_cat(tail) && !tail->args[1] &&
+        tail->out_file && !tail->in_file && tail->in_fd == -1 &&
+        !stages[*last - 1].out_file) {
+        stages[*last - 1].out_file = tail->out_file;
+        stages[*last - 1].append = tail->append;
+        tail->out_file = NULL;
+        (*last)--;
     }
+}
+
+// A builtin that can write into a pipeline from inside the shell itself
+static int runs_in_process(const pipe_stage_t *stage) {
+    char **args = stage->args;
+    if (!args || !args[0] || stage->in_file || stage->in_fd != -1 || stage->out_file ||
+        stage->fd_redirects.count) return 0;
+    if (find_function(args[0]) || get_alias(args[0])) return 0;
     
-    return last_status;
+    const builtin_t *builtin = find_builtin(args[0]);
+    return builtin && (builtin->flags & BUILTIN_PURE);
 }
 
-int handle_pipes(char **commands, int num_commands) {
-    if (num_commands <= 1) {
-        char **args = split_line(commands[0]);
-        int status = execute_command(args);
-        free_args(args);
-        return status;
-    }
+// Run the head of a pipeline in the shell with stdout pointed at the pipe.
+// The rest of the pipeline is already running, so the pipe has a reader;
+// one that exits early must not take the shell down with SIGPIPE.
+static void run_builtin_into_pipe(char **args, int out_fd) {
+    struct sigaction ignore, saved_action;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &saved_action);
     
-    int pipes[num_commands - 1][2];
-    pid_t pids[num_commands];
+    fflush(stdout);
+    int saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(out_fd, STDOUT_FILENO);
     
-    // Create all pipes
-    for (int i = 0; i < num_commands - 1; i++) {
-        if (pipe(pipes[i]) == -1) {
-            perror("pipe");
-            return 0;
-        }
+    execute_command(args);
+    
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    clearerr(stdout);
+    
+    sigaction(SIGPIPE, &saved_action, NULL);
+}
+
+static void free_pipe_stages(pipe_stage_t *stages, int count) {
+    for (int i = 0; i < count; i++) {
+        if (stages[i].in_fd != -1) close(stages[i].in_fd);
+        free_fd_redirects(&stages[i].fd_redirects);
+        free(stages[i].in_file);
+        free(stages[i].out_file);
+        free_args(stages[i].args);
     }
+}
+
+// Run a pipeline as one job, waiting for it unless it goes in the background
+int handle_pipes(node_t *pipeline, int background) {
+    int num_stages = pipeline->nchildren;
+    pipe_stage_t stages[num_stages];
+    int last_failed = 0;
     
-    // Create processes for each command
-    for (int i = 0; i < num_commands; i++) {
-        pids[i] = fork();
-        
-        if (pids[i] == -1) {
-            perror("fork");
-            return 0;
-        } else if (pids[i] == 0) {
-            // Child process
-            
-            // Set up input redirection (except for first command)
-            if (i > 0) {
-                dup2(pipes[i-1][0], STDIN_FILENO);
-            }
-            
-            // Set up output redirection (except for last command)
-            if (i < num_commands - 1) {
-                dup2(pipes[i][1], STDOUT_FILENO);
-            }
-            
-            // Close all pipe file descriptors
-            for (int j = 0; j < num_commands - 1; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
-            }
-            
-            // Execute command
-            char **args = split_line(commands[i]);
-            if (execvp(args[0], args) == -1) {
-                printf("%s: command not found\n", args[0]);
-                exit(EXIT_FAILURE);
-            }
+    // A stage that can't be expanded keeps the whole pipeline from starting
+    int expanded = 1;
+    for (int i = 0; i < num_stages; i++) {
+        pipe_stage_t *stage = &stages[i];
+        memset(stage, 0, sizeof(*stage));
+        stage->node = pipeline->children[i];
+        stage->in_fd = -1;
+        if (expanded && stage->node->type == NODE_COMMAND) {
+            stage->args = expand_words(stage->node->words);
+            expanded = stage->args &&
+                       expand_redirects(stage->node->redirects, &stage->in_file, &stage->in_fd,
+                                        &stage->out_file, &stage->append,
+                                        &stage->fd_redirects) == 0;
         }
     }
-    
-    // Parent process: close all pipes and wait for children
-    for (int i = 0; i < num_commands - 1; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+    if (!expanded) {
+        free_pipe_stages(stages, num_stages);
+        last_exit_status = 1;
+        return last_exit_status;
     }
     
-    // Wait for all processes
-    int status = 1;
-    for (int i = 0; i < num_commands; i++) {
-        int child_status;
-        waitpid(pids[i], &child_status, 0);
-        if (i == num_commands - 1) {  // Status of last command
-            status = WEXITSTATUS(child_status) == 0 ? 1 : 0;
-        }
+    int first = 0, last = num_stages - 1;
+    elide_copy_stages(stages, &first, &last);
+    int num_commands = last - first + 1;
+    int num_pipes = num_commands - 1;
+    int pipes[num_pipes > 0 ? num_pipes : 1][2];
+    
+    // Create all pipes
+    job_t *job = NULL;
+    int npipes_open = 0;
+    while (npipes_open < num_pipes && open_pipe(pipes[npipes_open]) == 0) {
+        npipes_open++;
+    }
+    if (npipes_open == num_pipes) {
+        char *text = node_text(pipeline);
+        job = create_job(text, !background);
+        free(text);
     }
     
-    return status;
-}
-
-int handle_redirection(char **args, char *input_file, char *output_file, int append) {
-    pid_t pid = fork();
+    // A side-effect-free builtin at the head of a foreground pipeline runs
+    // in the shell once the other stages are up
+    int head_in_process = job && !background && num_commands > 1 &&
+                          runs_in_process(&stages[first]);
     
-    if (pid == -1) {
-        perror("fork");
-        return 0;
-    } else if (pid == 0) {
-        // Child process
+    // Launch each stage with its pipe ends wired to stdin/stdout. A stage's
+    // own redirections take precedence over the pipe. Stages that are shell
+    // code (groups, functions, builtins) run in a forked copy of the shell.
+    for (int i = head_in_process; job && i < num_commands; i++) {
+        pipe_stage_t *stage = &stages[first + i];
+        char **args = stage->args;
         
-        // Handle input redirection
-        if (input_file) {
-            int fd_in = open(input_file, O_RDONLY);
-            if (fd_in == -1) {
-                perror("open input file");
-                exit(EXIT_FAILURE);
-            }
-            dup2(fd_in, STDIN_FILENO);
-            close(fd_in);
+        spawn_req_t req;
+        spawn_req_init(&req, args);
+        req.in_file = stage->in_file;
+        req.out_file = stage->out_file;
+        req.append = stage->append;
+        req.fd_redirects = &stage->fd_redirects;
+        if (!args) {
+            req.shell_fn = run_node_in_child;
+            req.shell_arg = stage->node;
+        } else if (args[0] && (find_function(args[0]) || is_builtin(args[0]) ||
+                               get_alias(args[0]))) {
+            req.shell_fn = run_command_in_child;
+            req.shell_arg = args;
+        } else if (i == 0 && is_plain_cat(stage) && args[1]) {
+            req.shell_fn = cat_files_to_stdout;
+            req.shell_arg = args + 1;
         }
         
-        // Handle output redirection
-        if (output_file) {
-            int flags = O_WRONLY | O_CREAT;
-            if (append) {
-                flags |= O_APPEND;
-            } else {
-                flags |= O_TRUNC;
-            }
-            
-            int fd_out = open(output_file, flags, 0644);
-            if (fd_out == -1) {
-                perror("open output file");
-                exit(EXIT_FAILURE);
-            }
-            dup2(fd_out, STDOUT_FILENO);
-            close(fd_out);
+        if (stage->in_fd != -1) {
+            req.in_fd = stage->in_fd;
+        } else if (i > 0) {
+            req.in_fd = pipes[i-1][0];
+        }
+        if (i < num_commands - 1) {
+            req.out_fd = pipes[i][1];
         }
+        req.close_fds = &pipes[0][0];
+        req.nclose = 2 * num_pipes;
+        req.job = job;
         
-        // Execute command
-        if (execvp(args[0], args) == -1) {
-            printf("%s: command not found\n", args[0]);
-            exit(EXIT_FAILURE);
+        pid_t pid = (req.shell_fn || args[0]) ? spawn_process(&req) : -1;
+        if (i == num_commands - 1) {
+            last_failed = pid == -1;
         }
-    } else {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);
-        return WEXITSTATUS(status) == 0 ? 1 : 0;
     }
     
-    return 1;
-}
-
-char *expand_variables(char *str) {
-    if (!str || strchr(str, '$') == NULL) {
-        return str;  // No variables to expand
+    if (head_in_process) {
+        run_builtin_into_pipe(stages[first].args, pipes[0][1]);
+    }
+    
+    // Parent process: close all pipes
+    for (int i = 0; i < npipes_open; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
     }
     
-    char *result = malloc(strlen(str) * 2);  // Allocate extra space
-    char *dst = result;
-    char *src = str;
+    free_pipe_stages(stages, num_stages);
     
-    while (*src) {
-        if (*src == '$' && (*(src+1) == '{' || isalnum(*(src+1)) || *(src+1) == '_')) {
-            src++;  // Skip $
-            
-            char var_name[256];
-            int var_len = 0;
-            
-            if (*src == '{') {
-                src++;  // Skip {
-                while (*src && *src != '}' && var_len < 255) {
-                    var_name[var_len++] = *src++;
-                }
-                if (*src == '}') src++;  // Skip }
-            } else {
-                while (*src && (isalnum(*src) || *src == '_') && var_len < 255) {
-                    var_name[var_len++] = *src++;
-                }
-            }
-            
-            var_name[var_len] = '\0';
-            
-            // Get variable value
-            char *var_value = get_shell_var(var_name);
-            if (!var_value) var_value = getenv(var_name);
-            if (!var_value) var_value = "";
-            
-            // Copy variable value to result
-            while (*var_value) {
-                *dst++ = *var_value++;
-            }
-        } else {
-            *dst++ = *src++;
-        }
+    if (!job) {
+        last_exit_status = 1;
+        return last_exit_status;
+    }
+    
+    if (background) {
+        background_job(job);
+        last_exit_status = last_failed ? 127 : 0;
+        return last_exit_status;
     }
     
-    *dst = '\0';
-    return result;
+    // The pipeline's status is the last stage's
+    int status = wait_for_job(job);
+    last_exit_status = (last_failed && status != 128 + SIGTSTP) ? 127 : status;
+    return last_exit_status;
 }
 
-char *expand_wildcards(char *pattern) {
-    glob_t glob_result;
+// Add a redirection to a list being built, replacing one of the same fd
+static void add_fd_redirect(fd_redirects_t *redirs, const fd_redirect_t *redir) {
+    int i = 0;
+    while (i < redirs->count && redirs->list[i].fd != redir->fd) i++;
+    redirs->list[i] = *redir;
+    if (i == redirs->count) redirs->count++;
+}
+
+// Builtins, functions and aliases run inside the shell, so their
+// redirections are applied to the shell's own descriptors for the duration
+// of the command. stdin and stdout are handled as fd redirections like the
+// rest, so that every replacement is opened above the descriptors it goes
+// onto.
+static int redirect_in_process(char **args, char *input_file, int input_fd, char *output_file, int append,
+                               const fd_redirects_t *fd_redirects) {
+    fd_redirects_t redirs;
+    redirs.count = 0;
+    if (input_file || input_fd != -1) {
+        fd_redirect_t in = { STDIN_FILENO, input_file, O_RDONLY, input_fd };
+        add_fd_redirect(&redirs, &in);
+    }
+    if (output_file) {
+        fd_redirect_t out = { STDOUT_FILENO, output_file,
+                              O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), -1 };
+        add_fd_redirect(&redirs, &out);
+    }
+    for (int i = 0; fd_redirects && i < fd_redirects->count; i++) {
+        add_fd_redirect(&redirs, &fd_redirects->list[i]);
+    }
     
-    if (glob(pattern, GLOB_TILDE, NULL, &glob_result) == 0) {
-        // Build result string from matches
-        size_t total_len = 0;
-        for (size_t i = 0; i < glob_result.gl_pathc; i++) {
-            total_len += strlen(glob_result.gl_pathv[i]) + 1;
-        }
-        
-        char *result = malloc(total_len + 1);
-        result[0] = '\0';
-        
-        for (size_t i = 0; i < glob_result.gl_pathc; i++) {
-            if (i > 0) strcat(result, " ");
-            strcat(result, glob_result.gl_pathv[i]);
+    int fds[MAX_REDIRECT_FD + 1];
+    if (open_fd_redirects(&redirs, fds) == -1) {
+        last_exit_status = 1;
+        return 1;
+    }
+    
+    fflush(stdout);
+    fflush(stderr);
+    int saved[MAX_REDIRECT_FD + 1];
+    for (int i = 0; i < redirs.count; i++) {
+        // -1 if the descriptor wasn't open, so it is closed again afterwards
+        saved[i] = fcntl(redirs.list[i].fd, F_DUPFD_CLOEXEC, 10);
+        if (fds[i] != -1) dup2(fds[i], redirs.list[i].fd);
+    }
+    close_fd_redirects(&redirs, fds);
+    
+    int keep_going = execute_command(args);
+    
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < redirs.count; i++) {
+        if (saved[i] == -1) {
+            close(redirs.list[i].fd);
+            continue;
         }
-        
-        globfree(&glob_result);
-        return result;
-    } else {
-        return strdup(pattern);  // No matches, return original
+        dup2(saved[i], redirs.list[i].fd);
+        close(saved[i]);
     }
+    return keep_going;
 }
 
-int run_script(char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("script");
-        return EXIT_FAILURE;
+int handle_redirection(char **args, char *input_file, int input_fd, char *output_file, int append,
+                       const fd_redirects_t *fd_redirects) {
+    if (is_builtin(args[0]) || find_function(args[0]) || get_alias(args[0])) {
+        return redirect_in_process(args, input_file, input_fd, output_file, append, fd_redirects);
     }
     
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
-    int status = 1;
+    spawn_req_t req;
+    spawn_req_init(&req, args);
+    req.in_file = input_file;
+    req.in_fd = input_fd;
+    req.out_file = output_file;
+    req.append = append;
+    req.fd_redirects = fd_redirects;
     
-    while ((read = getline(&line, &len, file)) != -1) {
-        // Remove newline
-        if (line[read-1] == '\n') {
-            line[read-1] = '\0';
-        }
-        
-        // Skip empty lines and comments
-        char *trimmed = trim_whitespace(line);
-        if (strlen(trimmed) == 0 || trimmed[0] == '#') {
-            continue;
+    char *text = join_words(args);
+    last_exit_status = run_in_foreground(&req, text ? text : args[0]);
+    free(text);
+    return 1;
+}
+
+// Run the argument of -c
+int run_string(const char *commands) {
+    int status;
+    parse_tree_t *tree = parse_command_line(commands, &status);
+    if (!tree) {
+        if (status == PARSE_INCOMPLETE) {
+            fprintf(stderr, "shell: -c: syntax error: unexpected end of file\n");
         }
-        
-        // Execute line
-        status = process_complex_command(trimmed);
-        if (!status) break;  // Exit command
+        return 2;
     }
     
-    free(line);
-    fclose(file);
-    return status ? EXIT_SUCCESS : EXIT_FAILURE;
+    execute_node(tree->root);
+    free_parse_tree(tree);
+    return last_exit_status;
+}
+
+int run_script(char *filename) {
+    // The whole file is parsed once, then executed
+    if (source_file(filename, NULL) == -1) {
+        return EXIT_FAILURE;
+    }
+    return last_exit_status;
 }
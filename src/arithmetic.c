@@ -0,0 +1,538 @@
+#include "shell.h"
+#include <limits.h>
+
+// Arithmetic: $(( expr )) and let.
+//
+// Expressions are evaluated in 64-bit signed integers with the C operators:
+// unary + - ! ~, the binary arithmetic, shift, comparison, bitwise and
+// logical operators, ?:, the comma operator, ++ and -- in both positions,
+// and = with every compound assignment. Variables are read from and written
+// to the shell variable store; an unset or empty one is 0, and one whose
+// value is not a number is evaluated as an expression itself.
+//
+// Each distinct expression text is compiled once into a small tree and kept
+// in a cache, so an expression met again in a loop or a function is only
+// walked, never parsed.
+
+#define ARITH_CACHE_MAX 1024    // compiled expressions kept before starting over
+#define ARITH_MAX_DEPTH 32      // variables whose values are expressions, nested
+
+// Tokens; operators of one character are the character itself
+enum {
+    T_END = 0,
+    T_NUMBER = 256,
+    T_NAME,
+    T_ASSIGN,               // = or op=, with op in lexer.assign_op
+    T_SHL,                  // <<
+    T_SHR,                  // >>
+    T_LE,                   // <=
+    T_GE,                   // >=
+    T_EQ,                   // ==
+    T_NE,                   // !=
+    T_LAND,                 // &&
+    T_LOR,                  // ||
+    T_INC,                  // ++
+    T_DEC                   // --
+};
+
+typedef enum {
+    ARITH_NUMBER,
+    ARITH_VARIABLE,
+    ARITH_UNARY,            // op a
+    ARITH_BINARY,           // a op b
+    ARITH_AND,              // a && b
+    ARITH_OR,               // a || b
+    ARITH_CONDITIONAL,      // a ? b : c
+    ARITH_ASSIGN,           // name = a, or name op= a
+    ARITH_PREFIX,           // ++name, --name
+    ARITH_POSTFIX,          // name++, name--
+    ARITH_COMMA             // a , b
+} arith_kind_t;
+
+typedef struct arith_node {
+    arith_kind_t kind;
+    int op;                 // token of the operator ('=' for plain assignment)
+    long long value;        // ARITH_NUMBER
+    char *name;             // variable read or assigned
+    struct arith_node *a, *b, *c;
+    struct arith_node *next;    // every node of the expression, for freeing
+} arith_node_t;
+
+typedef struct arith_expr {
+    arith_node_t *root;
+    arith_node_t *nodes;
+} arith_expr_t;
+
+typedef struct lexer {
+    const char *pos;
+    int tok;
+    long long value;        // T_NUMBER
+    const char *name;       // T_NAME, not terminated
+    size_t name_len;
+    int assign_op;          // T_ASSIGN
+    const char *error;      // first error met, or NULL
+    arith_expr_t *expr;
+} lexer_t;
+
+static hash_table_t arith_cache;
+
+static int evaluate_text(const char *text, long long *result, int depth);
+
+// Lexer
+
+static void arith_error(lexer_t *lex, const char *message) {
+    if (!lex->error) lex->error = message;
+    lex->tok = T_END;
+}
+
+static void next_token(lexer_t *lex) {
+    const char *s = lex->pos;
+    while (isspace((unsigned char)*s)) s++;
+
+    if (!*s) {
+        lex->tok = T_END;
+        lex->pos = s;
+        return;
+    }
+
+    if (isdigit((unsigned char)*s)) {
+        char *end;
+        errno = 0;
+        lex->value = (long long)strtoull(s, &end, 0);
+        if (errno == ERANGE || isalnum((unsigned char)*end) || *end == '_') {
+            arith_error(lex, "invalid number");
+            return;
+        }
+        lex->tok = T_NUMBER;
+        lex->pos = end;
+        return;
+    }
+
+    if (isalpha((unsigned char)*s) || *s == '_') {
+        lex->name = s;
+        while (isalnum((unsigned char)*s) || *s == '_') s++;
+        lex->name_len = s - lex->name;
+        lex->tok = T_NAME;
+        lex->pos = s;
+        return;
+    }
+
+    static const struct { const char *text; int tok; int assign_op; } ops[] = {
+        { "<<=", T_ASSIGN, T_SHL }, { ">>=", T_ASSIGN, T_SHR },
+        { "<<", T_SHL, 0 }, { ">>", T_SHR, 0 }, { "<=", T_LE, 0 }, { ">=", T_GE, 0 },
+        { "==", T_EQ, 0 }, { "!=", T_NE, 0 }, { "&&", T_LAND, 0 }, { "||", T_LOR, 0 },
+        { "++", T_INC, 0 }, { "--", T_DEC, 0 },
+        { "+=", T_ASSIGN, '+' }, { "-=", T_ASSIGN, '-' }, { "*=", T_ASSIGN, '*' },
+        { "/=", T_ASSIGN, '/' }, { "%=", T_ASSIGN, '%' }, { "&=", T_ASSIGN, '&' },
+        { "^=", T_ASSIGN, '^' }, { "|=", T_ASSIGN, '|' },
+    };
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        size_t len = strlen(ops[i].text);
+        if (strncmp(s, ops[i].text, len) == 0) {
+            lex->tok = ops[i].tok;
+            lex->assign_op = ops[i].assign_op;
+            lex->pos = s + len;
+            return;
+        }
+    }
+
+    if (*s == '=') {
+        lex->tok = T_ASSIGN;
+        lex->assign_op = '=';
+    } else if (strchr("+-*/%<>&|^!~?:(),", *s)) {
+        lex->tok = *s;
+    } else {
+        arith_error(lex, "syntax error: invalid character");
+        return;
+    }
+    lex->pos = s + 1;
+}
+
+// Parser: precedence climbing over the C operator table
+
+static arith_node_t *new_node(lexer_t *lex, arith_kind_t kind) {
+    arith_node_t *node = calloc(1, sizeof(arith_node_t));
+    if (!node) {
+        fprintf(stderr, "allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    node->kind = kind;
+    node->next = lex->expr->nodes;
+    lex->expr->nodes = node;
+    return node;
+}
+
+static arith_node_t *parse_comma(lexer_t *lex);
+static arith_node_t *parse_assignment(lexer_t *lex);
+
+static arith_node_t *parse_primary(lexer_t *lex) {
+    arith_node_t *node;
+
+    switch (lex->tok) {
+    case T_NUMBER:
+        node = new_node(lex, ARITH_NUMBER);
+        node->value = lex->value;
+        next_token(lex);
+        return node;
+    case T_NAME:
+        node = new_node(lex, ARITH_VARIABLE);
+        node->name = strndup(lex->name, lex->name_len);
+        next_token(lex);
+        if (lex->tok == T_INC || lex->tok == T_DEC) {
+            node->kind = ARITH_POSTFIX;
+            node->op = lex->tok;
+            next_token(lex);
+        }
+        return node;
+    case '(':
+        next_token(lex);
+        node = parse_comma(lex);
+        if (lex->tok != ')') {
+            arith_error(lex, "syntax error: missing `)'");
+            return NULL;
+        }
+        next_token(lex);
+        return node;
+    default:
+        arith_error(lex, "syntax error: operand expected");
+        return NULL;
+    }
+}
+
+static arith_node_t *parse_unary(lexer_t *lex) {
+    int op = lex->tok;
+
+    if (op == T_INC || op == T_DEC) {
+        next_token(lex);
+        if (lex->tok != T_NAME) {
+            arith_error(lex, "syntax error: variable expected after ++ or --");
+            return NULL;
+        }
+        arith_node_t *node = new_node(lex, ARITH_PREFIX);
+        node->op = op;
+        node->name = strndup(lex->name, lex->name_len);
+        next_token(lex);
+        return node;
+    }
+    if (op == '+' || op == '-' || op == '!' || op == '~') {
+        next_token(lex);
+        arith_node_t *node = new_node(lex, ARITH_UNARY);
+        node->op = op;
+        node->a = parse_unary(lex);
+        return node->a ? node : NULL;
+    }
+    return parse_primary(lex);
+}
+
+static int binary_precedence(int tok) {
+    switch (tok) {
+    case T_LOR:                         return 1;
+    case T_LAND:                        return 2;
+    case '|':                           return 3;
+    case '^':                           return 4;
+    case '&':                           return 5;
+    case T_EQ: case T_NE:               return 6;
+    case '<': case '>': case T_LE: case T_GE: return 7;
+    case T_SHL: case T_SHR:             return 8;
+    case '+': case '-':                 return 9;
+    case '*': case '/': case '%':       return 10;
+    default:                            return 0;
+    }
+}
+
+static arith_node_t *parse_binary(lexer_t *lex, int min_precedence) {
+    arith_node_t *left = parse_unary(lex);
+
+    int precedence;
+    while (left && (precedence = binary_precedence(lex->tok)) >= min_precedence) {
+        int op = lex->tok;
+        next_token(lex);
+        arith_node_t *right = parse_binary(lex, precedence + 1);
+        if (!right) return NULL;
+
+        arith_kind_t kind = op == T_LAND ? ARITH_AND : op == T_LOR ? ARITH_OR : ARITH_BINARY;
+        arith_node_t *node = new_node(lex, kind);
+        node->op = op;
+        node->a = left;
+        node->b = right;
+        left = node;
+    }
+    return left;
+}
+
+static arith_node_t *parse_conditional(lexer_t *lex) {
+    arith_node_t *cond = parse_binary(lex, 1);
+    if (!cond || lex->tok != '?') return cond;
+
+    next_token(lex);
+    arith_node_t *node = new_node(lex, ARITH_CONDITIONAL);
+    node->a = cond;
+    node->b = parse_comma(lex);
+    if (!node->b) return NULL;
+    if (lex->tok != ':') {
+        arith_error(lex, "syntax error: `:' expected for conditional expression");
+        return NULL;
+    }
+    next_token(lex);
+    node->c = parse_conditional(lex);
+    return node->c ? node : NULL;
+}
+
+// Assignment is right-associative, and only a variable can take one
+static arith_node_t *parse_assignment(lexer_t *lex) {
+    arith_node_t *left = parse_conditional(lex);
+    if (!left || lex->tok != T_ASSIGN) return left;
+
+    if (left->kind != ARITH_VARIABLE) {
+        arith_error(lex, "attempted assignment to non-variable");
+        return NULL;
+    }
+    left->kind = ARITH_ASSIGN;
+    left->op = lex->assign_op;
+    next_token(lex);
+    left->a = parse_assignment(lex);
+    return left->a ? left : NULL;
+}
+
+static arith_node_t *parse_comma(lexer_t *lex) {
+    arith_node_t *left = parse_assignment(lex);
+
+    while (left && lex->tok == ',') {
+        next_token(lex);
+        arith_node_t *node = new_node(lex, ARITH_COMMA);
+        node->a = left;
+        node->b = parse_assignment(lex);
+        if (!node->b) return NULL;
+        left = node;
+    }
+    return left;
+}
+
+static void free_expr(void *value) {
+    arith_expr_t *expr = value;
+    arith_node_t *node = expr->nodes;
+    while (node) {
+        arith_node_t *next = node->next;
+        free(node->name);
+        free(node);
+        node = next;
+    }
+    free(expr);
+}
+
+// Compile text, or print why it can't be and return NULL
+static arith_expr_t *compile(const char *text) {
+    arith_expr_t *expr = calloc(1, sizeof(arith_expr_t));
+    if (!expr) return NULL;
+
+    lexer_t lex = { 0 };
+    lex.pos = text;
+    lex.expr = expr;
+    next_token(&lex);
+
+    // An empty expression is 0
+    if (lex.tok == T_END && !lex.error) {
+        expr->root = new_node(&lex, ARITH_NUMBER);
+        return expr;
+    }
+
+    expr->root = parse_comma(&lex);
+    if (!lex.error && lex.tok != T_END) {
+        arith_error(&lex, "syntax error in expression");
+    }
+    if (lex.error) {
+        fprintf(stderr, "shell: arithmetic: %s: %s (error token is \"%s\")\n", text, lex.error, lex.pos);
+        free_expr(expr);
+        return NULL;
+    }
+    return expr;
+}
+
+// Evaluation
+
+static int eval_error(const char *message) {
+    fprintf(stderr, "shell: arithmetic: %s\n", message);
+    return -1;
+}
+
+static int read_variable(const char *name, long long *result, int depth) {
+    char *value = get_shell_var((char *)name);
+    if (!value || !*value) {
+        *result = 0;
+        return 0;
+    }
+
+    char *end;
+    errno = 0;
+    long long number = strtoll(value, &end, 0);
+    while (isspace((unsigned char)*end)) end++;
+    if (*end == '\0' && errno != ERANGE) {
+        *result = number;
+        return 0;
+    }
+
+    if (depth >= ARITH_MAX_DEPTH) {
+        return eval_error("expression recursion level exceeded");
+    }
+    return evaluate_text(value, result, depth + 1);
+}
+
+// Decimal text of value, built backwards from the end of buf[24]
+static char *format_number(long long value, char *buf) {
+    unsigned long long n = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    char *p = buf + 23;
+    *p = '\0';
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    if (value < 0) *--p = '-';
+    return p;
+}
+
+static void write_variable(const char *name, long long value) {
+    char buf[24];
+    set_shell_var((char *)name, format_number(value, buf));
+}
+
+// Apply a binary operator. Wrapping arithmetic, as the hardware does it,
+// rather than undefined behavior on overflow.
+static int apply(int op, long long x, long long y, long long *result) {
+    unsigned long long ux = x, uy = y;
+
+    switch (op) {
+    case '+':   *result = (long long)(ux + uy); break;
+    case '-':   *result = (long long)(ux - uy); break;
+    case '*':   *result = (long long)(ux * uy); break;
+    case '/':
+    case '%':
+        if (y == 0) return eval_error("division by 0");
+        if (x == LLONG_MIN && y == -1) {
+            *result = op == '/' ? LLONG_MIN : 0;
+        } else {
+            *result = op == '/' ? x / y : x % y;
+        }
+        break;
+    case T_SHL: *result = (long long)(ux << (y & 63)); break;
+    case T_SHR: *result = x >> (y & 63); break;
+    case '<':   *result = x < y; break;
+    case '>':   *result = x > y; break;
+    case T_LE:  *result = x <= y; break;
+    case T_GE:  *result = x >= y; break;
+    case T_EQ:  *result = x == y; break;
+    case T_NE:  *result = x != y; break;
+    case '&':   *result = x & y; break;
+    case '^':   *result = x ^ y; break;
+    case '|':   *result = x | y; break;
+    default:    return eval_error("unknown operator");
+    }
+    return 0;
+}
+
+static int eval(const arith_node_t *node, long long *result, int depth) {
+    long long x, y;
+
+    switch (node->kind) {
+    case ARITH_NUMBER:
+        *result = node->value;
+        return 0;
+    case ARITH_VARIABLE:
+        return read_variable(node->name, result, depth);
+    case ARITH_UNARY:
+        if (eval(node->a, &x, depth) == -1) return -1;
+        switch (node->op) {
+        case '-':   *result = (long long)(0ULL - (unsigned long long)x); break;
+        case '!':   *result = !x; break;
+        case '~':   *result = ~x; break;
+        default:    *result = x; break;
+        }
+        return 0;
+    case ARITH_BINARY:
+        if (eval(node->a, &x, depth) == -1 || eval(node->b, &y, depth) == -1) return -1;
+        return apply(node->op, x, y, result);
+    case ARITH_AND:
+    case ARITH_OR:
+        if (eval(node->a, &x, depth) == -1) return -1;
+        if ((node->kind == ARITH_AND) != (x != 0)) {
+            *result = x != 0;
+            return 0;
+        }
+        if (eval(node->b, &y, depth) == -1) return -1;
+        *result = y != 0;
+        return 0;
+    case ARITH_CONDITIONAL:
+        if (eval(node->a, &x, depth) == -1) return -1;
+        return eval(x ? node->b : node->c, result, depth);
+    case ARITH_ASSIGN:
+        if (eval(node->a, &y, depth) == -1) return -1;
+        if (node->op != '=') {
+            if (read_variable(node->name, &x, depth) == -1) return -1;
+            if (apply(node->op, x, y, &y) == -1) return -1;
+        }
+        write_variable(node->name, y);
+        *result = y;
+        return 0;
+    case ARITH_PREFIX:
+    case ARITH_POSTFIX:
+        if (read_variable(node->name, &x, depth) == -1) return -1;
+        y = (long long)((unsigned long long)x + (node->op == T_INC ? 1 : -1ULL));
+        write_variable(node->name, y);
+        *result = node->kind == ARITH_PREFIX ? y : x;
+        return 0;
+    case ARITH_COMMA:
+        if (eval(node->a, &x, depth) == -1) return -1;
+        return eval(node->b, result, depth);
+    }
+    return -1;
+}
+
+static int evaluate_text(const char *text, long long *result, int depth) {
+    arith_expr_t *expr = hash_table_get(&arith_cache, text);
+    if (expr) return eval(expr->root, result, depth);
+
+    expr = compile(text);
+    if (!expr) return -1;
+
+    // Expressions being walked further up must stay alive, so the cache is
+    // only emptied at the outermost level
+    if (arith_cache.count >= ARITH_CACHE_MAX && depth == 0) {
+        hash_table_clear(&arith_cache, free_expr);
+    }
+    if (arith_cache.count < ARITH_CACHE_MAX) {
+        hash_table_put(&arith_cache, text, expr);
+        return eval(expr->root, result, depth);
+    }
+
+    int status = eval(expr->root, result, depth);
+    free_expr(expr);
+    return status;
+}
+
+// Evaluate an expression. Returns 0 with the value in *result, or -1 after
+// reporting the error.
+int arith_evaluate(const char *text, long long *result) {
+    return evaluate_text(text, result, 0);
+}
+
+void free_arithmetic(void) {
+    hash_table_clear(&arith_cache, free_expr);
+}
+
+// let expr...: evaluate each; the status is 0 if the last one is nonzero
+int cmd_let(char **args) {
+    if (!args[1]) {
+        printf("Usage: let expression...\n");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    long long value = 0;
+    for (int i = 1; args[i]; i++) {
+        if (arith_evaluate(args[i], &value) == -1) {
+            last_exit_status = 1;
+            return 1;
+        }
+    }
+    last_exit_status = value == 0;
+    return 1;
+}
@@ -12,6 +12,7 @@ int cmd_cd(char **args) {
     
     if (chdir(dir) != 0) {
         perror("cd");
+        last_exit_status = 1;
     } else {
         // Update PWD variable
         char cwd[1024];
@@ -30,6 +31,7 @@ int cmd_pwd(char **args) {
         printf("%s\n", cwd);
     } else {
         perror("pwd");
+        last_exit_status = 1;
     }
     return 1;
 }
@@ -45,36 +47,37 @@ int cmd_exit(char **args) {
 int cmd_help(char **args) {
     (void)args; // Suppress unused parameter warning
     printf("Advanced Shell - Built-in commands:\n");
-    printf("  cd [dir]          - Change directory\n");
-    printf("  pwd               - Print working directory\n");
-    printf("  exit [code]       - Exit shell\n");
-    printf("  help              - Show this help\n");
-    printf("  history           - Show command history\n");
-    printf("  jobs              - Show active jobs\n");
-    printf("  fg [job]          - Bring job to foreground\n");
-    printf("  bg [job]          - Send job to background\n");
-    printf("  kill [pid/job]    - Kill process or job\n");
-    printf("  export var=value  - Set environment variable\n");
-    printf("  unset var         - Unset variable\n");
-    printf("  alias name=value  - Create alias\n");
-    printf("  unalias name      - Remove alias\n");
-    printf("  echo [text]       - Display text\n");
-    printf("  type command      - Show command type\n");
+    for (size_t i = 0; i < builtin_count; i++) {
+        if (builtins[i].description) {
+            printf("  %-18s - %s\n", builtins[i].usage, builtins[i].description);
+        }
+    }
     printf("\nFeatures:\n");
     printf("  - Pipes: cmd1 | cmd2\n");
     printf("  - Redirection: cmd > file, cmd < file, cmd >> file\n");
     printf("  - Background: cmd &\n");
     printf("  - Command chaining: cmd1 && cmd2, cmd1 || cmd2, cmd1 ; cmd2\n");
     printf("  - Variable expansion: $VAR\n");
+    printf("  - Functions: name() { commands; }\n");
     printf("  - Wildcard expansion: *.txt\n");
-    printf("  - Tab completion (basic)\n");
+    printf("  - Tab completion of commands and file names\n");
     return 1;
 }
 
 int cmd_history(char **args) {
-    (void)args; // Suppress unused parameter warning
-    for (int i = 0; i < history_count; i++) {
-        printf("%4d  %s\n", i + 1, history[i]);
+    long first = history.base;
+    long end = history.base + history.count;
+    
+    // history N shows only the last N entries
+    if (args[1]) {
+        long n = atol(args[1]);
+        if (n >= 0 && n < history.count) {
+            first = end - n;
+        }
+    }
+    
+    for (long i = first; i < end; i++) {
+        printf("%5ld  %s\n", i, history_get(i));
     }
     return 1;
 }
@@ -96,101 +99,100 @@ int cmd_jobs(char **args) {
 }
 
 int cmd_fg(char **args) {
-    int job_id = 1;
-    if (args[1]) {
-        job_id = atoi(args[1]);
+    job_t *job = parse_job_spec(args[1]);
+    if (!job) {
+        printf("fg: %s: no such job\n", args[1] ? args[1] : "current");
+        last_exit_status = 1;
+        return 1;
     }
     
-    job_t *job = find_job(job_id);
-    if (job) {
-        if (kill(job->pid, SIGCONT) == 0) {
-            job->status = JOB_RUNNING;
-            printf("[%d] %s\n", job->id, job->command);
-            
-            int status;
-            waitpid(job->pid, &status, 0);
-            remove_job(job->pid);
-        } else {
-            perror("fg");
-        }
-    } else {
-        printf("Job %d not found\n", job_id);
-    }
+    printf("%s\n", job->command);
+    last_exit_status = continue_job(job, 1);
     return 1;
 }
 
 int cmd_bg(char **args) {
-    int job_id = 1;
-    if (args[1]) {
-        job_id = atoi(args[1]);
+    job_t *job = parse_job_spec(args[1]);
+    if (!job) {
+        printf("bg: %s: no such job\n", args[1] ? args[1] : "current");
+        last_exit_status = 1;
+        return 1;
     }
     
-    job_t *job = find_job(job_id);
-    if (job) {
-        if (kill(job->pid, SIGCONT) == 0) {
-            job->status = JOB_RUNNING;
-            printf("[%d] %s &\n", job->id, job->command);
-        } else {
-            perror("bg");
-        }
-    } else {
-        printf("Job %d not found\n", job_id);
-    }
+    printf("[%d] %s &\n", job->id, job->command);
+    last_exit_status = continue_job(job, 0);
     return 1;
 }
 
 int cmd_kill(char **args) {
     if (!args[1]) {
-        printf("Usage: kill <pid|job>\n");
+        printf("Usage: kill <pid|%%job>\n");
+        last_exit_status = 1;
         return 1;
     }
     
-    int pid = atoi(args[1]);
-    if (pid == 0 && args[1][0] == '%') {
-        // Job specification
-        int job_id = atoi(args[1] + 1);
-        job_t *job = find_job(job_id);
-        if (job) {
-            pid = job->pid;
-        } else {
-            printf("Job %d not found\n", job_id);
+    // The job stays listed until its exit is reaped and reported
+    if (args[1][0] == '%') {
+        job_t *job = parse_job_spec(args[1]);
+        if (!job) {
+            printf("kill: %s: no such job\n", args[1]);
+            last_exit_status = 1;
             return 1;
         }
+        if (signal_job(job, SIGTERM) == 0) {
+            // A stopped job has to run to act on the signal
+            if (job->status == JOB_STOPPED) signal_job(job, SIGCONT);
+            printf("Job %d terminated\n", job->id);
+        } else {
+            perror("kill");
+            last_exit_status = 1;
+        }
+        return 1;
     }
     
+    int pid = atoi(args[1]);
     if (kill(pid, SIGTERM) == 0) {
         printf("Process %d terminated\n", pid);
-        remove_job(pid);
     } else {
         perror("kill");
+        last_exit_status = 1;
     }
     return 1;
 }
 
 int cmd_export(char **args) {
     if (!args[1]) {
-        // Display all environment variables
-        char **env = environ;
-        while (*env) {
-            printf("%s\n", *env);
-            env++;
+        // Display the exported variables, sorted by name
+        char **env = shell_envp();
+        size_t count = 0;
+        while (env[count]) count++;
+        
+        char **entries = malloc((count + 1) * sizeof(char*));
+        memcpy(entries, env, count * sizeof(char*));
+        qsort(entries, count, sizeof(char*), compare_strings);
+        for (size_t i = 0; i < count; i++) {
+            printf("%s\n", entries[i]);
         }
+        free(entries);
         return 1;
     }
     
-    char *equals = strchr(args[1], '=');
-    if (equals) {
-        *equals = '\0';
-        char *name = args[1];
-        char *value = equals + 1;
-        
-        if (setenv(name, value, 1) == 0) {
-            set_shell_var(name, value);
-        } else {
-            perror("export");
+    for (int i = 1; args[i]; i++) {
+        char *name = args[i];
+        char *value = NULL;
+        char *equals = strchr(name, '=');
+        if (equals) {
+            *equals = '\0';
+            value = equals + 1;
         }
-    } else {
-        printf("Usage: export VAR=value\n");
+        if (*name == '\0') {
+            printf("Usage: export VAR[=value]\n");
+            last_exit_status = 1;
+            continue;
+        }
+        
+        export_shell_var(name, value);
+        if (value && strcmp(name, "PATH") == 0) hash_invalidate();
     }
     return 1;
 }
@@ -198,23 +200,31 @@ int cmd_export(char **args) {
 int cmd_unset(char **args) {
     if (!args[1]) {
         printf("Usage: unset VAR\n");
+        last_exit_status = 1;
         return 1;
     }
     
-    if (unsetenv(args[1]) == 0) {
-        unset_shell_var(args[1]);
-    } else {
-        perror("unset");
+    for (int i = 1; args[i]; i++) {
+        unset_shell_var(args[i]);
+        if (strcmp(args[i], "PATH") == 0) hash_invalidate();
     }
     return 1;
 }
 
 int cmd_alias(char **args) {
     if (!args[1]) {
-        // Display all aliases
-        for (int i = 0; i < alias_count; i++) {
-            printf("alias %s='%s'\n", aliases[i].name, aliases[i].value);
+        // Display all aliases, sorted by name
+        const char **names = malloc((alias_table.count + 1) * sizeof(char*));
+        size_t count = 0, pos = 0;
+        while (hash_table_next(&alias_table, &pos, &names[count], NULL)) {
+            count++;
+        }
+        qsort(names, count, sizeof(char*), compare_strings);
+        
+        for (size_t i = 0; i < count; i++) {
+            printf("alias %s='%s'\n", names[i], get_alias((char *)names[i]));
         }
+        free(names);
         return 1;
     }
     
@@ -230,6 +240,7 @@ int cmd_alias(char **args) {
             printf("alias %s='%s'\n", args[1], value);
         } else {
             printf("alias: %s: not found\n", args[1]);
+            last_exit_status = 1;
         }
     }
     return 1;
@@ -238,6 +249,7 @@ int cmd_alias(char **args) {
 int cmd_unalias(char **args) {
     if (!args[1]) {
         printf("Usage: unalias name\n");
+        last_exit_status = 1;
         return 1;
     }
     
@@ -246,15 +258,10 @@ int cmd_unalias(char **args) {
 }
 
 int cmd_echo(char **args) {
+    // Arguments arrive already expanded
     for (int i = 1; args[i]; i++) {
         if (i > 1) printf(" ");
-        
-        // Expand variables
-        char *expanded = expand_variables(args[i]);
-        printf("%s", expanded);
-        if (expanded != args[i]) {
-            free(expanded);
-        }
+        printf("%s", args[i]);
     }
     printf("\n");
     return 1;
@@ -263,19 +270,20 @@ int cmd_echo(char **args) {
 int cmd_type(char **args) {
     if (!args[1]) {
         printf("Usage: type command\n");
+        last_exit_status = 1;
         return 1;
     }
     
-    // Check if builtin
-    char *builtins[] = {"cd", "pwd", "exit", "help", "history", "jobs", 
-                       "fg", "bg", "kill", "export", "unset", "alias", 
-                       "unalias", "echo", "type", NULL};
+    // Check if function
+    if (find_function(args[1])) {
+        printf("%s is a function\n", args[1]);
+        return 1;
+    }
     
-    for (int i = 0; builtins[i]; i++) {
-        if (strcmp(args[1], builtins[i]) == 0) {
-            printf("%s is a shell builtin\n", args[1]);
-            return 1;
-        }
+    // Check if builtin
+    if (find_builtin(args[1])) {
+        printf("%s is a shell builtin\n", args[1]);
+        return 1;
     }
     
     // Check if alias
@@ -286,25 +294,50 @@ int cmd_type(char **args) {
     }
     
     // Check PATH
-    char *path = getenv("PATH");
+    const char *path = find_command(args[1]);
     if (path) {
-        char *path_copy = strdup(path);
-        char *dir = strtok(path_copy, ":");
-        
-        while (dir) {
-            char full_path[1024];
-            snprintf(full_path, sizeof(full_path), "%s/%s", dir, args[1]);
-            
-            if (access(full_path, X_OK) == 0) {
-                printf("%s is %s\n", args[1], full_path);
-                free(path_copy);
-                return 1;
-            }
-            dir = strtok(NULL, ":");
-        }
-        free(path_copy);
+        printf("%s is %s\n", args[1], path);
+        return 1;
     }
     
     printf("%s: not found\n", args[1]);
+    last_exit_status = 1;
     return 1;
 }
+
+// Builtin registry: the single list consulted by the dispatcher, is_builtin,
+// type and help. Keep it sorted by name (strcmp order) for find_builtin.
+const builtin_t builtins[] = {
+    { ".",       cmd_source,  0, NULL, NULL },
+    { "alias",   cmd_alias,   0, "alias name=value", "Create alias" },
+    { "bench",   cmd_bench,   0, "bench [-n N] command", "Run command N times and report timing statistics" },
+    { "bg",      cmd_bg,      0, "bg [%job]", "Resume job in the background" },
+    { "cd",      cmd_cd,      0, "cd [dir]", "Change directory" },
+    { "echo",    cmd_echo,    BUILTIN_PURE, "echo [text]", "Display text" },
+    { "exit",    cmd_exit,    0, "exit [code]", "Exit shell" },
+    { "export",  cmd_export,  0, "export var[=value]", "Set and export variables" },
+    { "fg",      cmd_fg,      0, "fg [%job]", "Bring job to foreground" },
+    { "hash",    cmd_hash,    0, "hash [-r] [name]", "Show, clear or add remembered command paths" },
+    { "help",    cmd_help,    BUILTIN_PURE, "help", "Show this help" },
+    { "history", cmd_history, BUILTIN_PURE, "history [n]", "Show command history" },
+    { "jobs",    cmd_jobs,    0, "jobs", "Show active jobs" },
+    { "kill",    cmd_kill,    0, "kill pid|%job", "Kill process or job" },
+    { "let",     cmd_let,     0, "let expression...", "Evaluate arithmetic expressions" },
+    { "parallel", cmd_parallel, 0, "parallel [-j N] cmd [{}] [::: args]", "Run cmd once per argument, N at a time" },
+    { "pwd",     cmd_pwd,     BUILTIN_PURE, "pwd", "Print working directory" },
+    { "return",  cmd_return,  BUILTIN_KEEPS_STATUS, "return [n]", "Return from a function or sourced script" },
+    { "source",  cmd_source,  0, "source file [args]", "Run a script in the current shell (also: .)" },
+    { "type",    cmd_type,    BUILTIN_PURE, "type command", "Show command type" },
+    { "unalias", cmd_unalias, 0, "unalias name", "Remove alias" },
+    { "unset",   cmd_unset,   0, "unset var", "Unset variable" },
+};
+
+const size_t builtin_count = sizeof(builtins) / sizeof(builtins[0]);
+
+static int compare_builtin(const void *key, const void *entry) {
+    return strcmp(key, ((const builtin_t *)entry)->name);
+}
+
+const builtin_t *find_builtin(const char *name) {
+    return bsearch(name, builtins, builtin_count, sizeof(builtin_t), compare_builtin);
+}
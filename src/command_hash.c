@@ -0,0 +1,187 @@
+#include "shell.h"
+
+// Remembered command locations, in the spirit of bash's `hash`. The first
+// lookup of a name walks $PATH; later lookups are a table hit. The table is
+// dropped when PATH is changed through export/unset, and when any PATH
+// directory's mtime moves (something was installed or removed). Directory
+// mtimes are re-checked at most once per HASH_RECHECK_INTERVAL seconds so a
+// tight script loop doesn't stat every PATH entry on every command.
+
+#define HASH_RECHECK_INTERVAL 1
+
+typedef struct hashed_command {
+    char *path;
+    int hits;
+} hashed_command_t;
+
+typedef struct path_dir {
+    char *path;
+    struct timespec mtime;  // zero when the directory doesn't exist
+} path_dir_t;
+
+static hash_table_t command_table;
+static path_dir_t *path_dirs = NULL;
+static int path_dir_count = 0;
+static int path_loaded = 0;
+static time_t last_recheck = 0;
+
+static void free_hashed_command(void *value) {
+    hashed_command_t *cmd = value;
+    free(cmd->path);
+    free(cmd);
+}
+
+static void dir_mtime(const char *path, struct timespec *mtime) {
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        *mtime = st.st_mtim;
+    } else {
+        mtime->tv_sec = 0;
+        mtime->tv_nsec = 0;
+    }
+}
+
+static void free_path_dirs(void) {
+    for (int i = 0; i < path_dir_count; i++) {
+        free(path_dirs[i].path);
+    }
+    free(path_dirs);
+    path_dirs = NULL;
+    path_dir_count = 0;
+    path_loaded = 0;
+}
+
+// Split $PATH once and record each directory's mtime
+static void load_path_dirs(void) {
+    char *path_env = getenv("PATH");
+    path_loaded = 1;
+    last_recheck = time(NULL);
+    if (!path_env) return;
+
+    int count = 1;
+    for (char *p = path_env; *p; p++) {
+        if (*p == ':') count++;
+    }
+    path_dirs = malloc(count * sizeof(path_dir_t));
+
+    const char *start = path_env;
+    for (;;) {
+        const char *end = strchr(start, ':');
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+
+        // An empty element means the current directory
+        char *dir = len ? strndup(start, len) : strdup(".");
+        path_dirs[path_dir_count].path = dir;
+        dir_mtime(dir, &path_dirs[path_dir_count].mtime);
+        path_dir_count++;
+
+        if (!end) break;
+        start = end + 1;
+    }
+}
+
+// Throw everything away if a PATH directory changed since we looked at it
+static void recheck_path_dirs(void) {
+    time_t now = time(NULL);
+    if (now - last_recheck < HASH_RECHECK_INTERVAL) return;
+    last_recheck = now;
+
+    for (int i = 0; i < path_dir_count; i++) {
+        struct timespec mtime;
+        dir_mtime(path_dirs[i].path, &mtime);
+        if (mtime.tv_sec != path_dirs[i].mtime.tv_sec ||
+            mtime.tv_nsec != path_dirs[i].mtime.tv_nsec) {
+            hash_invalidate();
+            return;
+        }
+    }
+}
+
+static char *search_path(const char *name) {
+    size_t name_len = strlen(name);
+
+    for (int i = 0; i < path_dir_count; i++) {
+        size_t dir_len = strlen(path_dirs[i].path);
+        char *full_path = malloc(dir_len + name_len + 2);
+        memcpy(full_path, path_dirs[i].path, dir_len);
+        full_path[dir_len] = '/';
+        memcpy(full_path + dir_len + 1, name, name_len + 1);
+
+        struct stat st;
+        if (stat(full_path, &st) == 0 && S_ISREG(st.st_mode) &&
+            access(full_path, X_OK) == 0) {
+            return full_path;
+        }
+        free(full_path);
+    }
+    return NULL;
+}
+
+const char *find_command(const char *name) {
+    if (strchr(name, '/')) {
+        return name;
+    }
+
+    if (path_loaded) {
+        recheck_path_dirs();
+    }
+    if (!path_loaded) {
+        load_path_dirs();
+    }
+
+    hashed_command_t *cmd = hash_table_get(&command_table, name);
+    if (cmd) {
+        cmd->hits++;
+        return cmd->path;
+    }
+
+    char *path = search_path(name);
+    if (!path) return NULL;
+
+    cmd = malloc(sizeof(hashed_command_t));
+    cmd->path = path;
+    cmd->hits = 1;
+    hash_table_put(&command_table, name, cmd);
+    return path;
+}
+
+void hash_forget_command(const char *name) {
+    hashed_command_t *cmd = hash_table_remove(&command_table, name);
+    if (cmd) free_hashed_command(cmd);
+}
+
+void hash_invalidate(void) {
+    hash_table_clear(&command_table, free_hashed_command);
+    free_path_dirs();
+}
+
+int cmd_hash(char **args) {
+    if (!args[1]) {
+        if (command_table.count == 0) {
+            printf("hash: hash table empty\n");
+            return 1;
+        }
+
+        printf("hits\tcommand\n");
+        size_t pos = 0;
+        void *value;
+        while (hash_table_next(&command_table, &pos, NULL, &value)) {
+            hashed_command_t *cmd = value;
+            printf("%4d\t%s\n", cmd->hits, cmd->path);
+        }
+        return 1;
+    }
+
+    if (strcmp(args[1], "-r") == 0) {
+        hash_invalidate();
+        return 1;
+    }
+
+    for (int i = 1; args[i]; i++) {
+        if (!find_command(args[i])) {
+            fprintf(stderr, "hash: %s: not found\n", args[i]);
+            last_exit_status = 1;
+        }
+    }
+    return 1;
+}
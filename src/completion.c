@@ -0,0 +1,461 @@
+#include "shell.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+// Candidates for Tab completion.
+//
+// Command names come from the builtins, aliases and functions, which are
+// few and looked at directly, and from the executables in every $PATH
+// directory, which are kept in a prefix trie. The trie is first built on
+// a background thread as soon as the line editor starts, so it is usually
+// ready by the first Tab. After that each Tab only stats the PATH
+// directories and rescans those whose mtime moved (or that PATH gained).
+// A trie node counts the directories providing the name that ends there,
+// so a directory can be rescanned without disturbing the others.
+//
+// File names come from directory listings cached by path and reused until
+// the directory's mtime changes. A listing is kept sorted, so the matches
+// for a prefix are found by binary search rather than a readdir of the
+// whole directory.
+
+#define LISTING_CACHE_MAX 64
+
+typedef struct trie_node {
+    struct trie_node *child;    // first child; siblings are sorted by byte
+    struct trie_node *sibling;
+    int refs;                   // PATH directories with the name ending here
+    unsigned char c;
+} trie_node_t;
+
+typedef struct command_dir {
+    char *path;
+    struct timespec mtime;
+    char **names;               // executables found at the last scan
+    int count;
+} command_dir_t;
+
+typedef struct dir_listing {
+    struct timespec mtime;
+    char **names;               // sorted
+    unsigned char *kinds;       // LISTING_* for each name
+    size_t count;
+} dir_listing_t;
+
+enum { LISTING_FILE, LISTING_DIR, LISTING_UNKNOWN };
+
+// Candidates being collected
+typedef struct match_list {
+    char **items;
+    int count;
+    int capacity;
+} match_list_t;
+
+static trie_node_t trie_root;
+static command_dir_t *command_dirs = NULL;
+static int command_dir_count = 0;
+static char *command_path = NULL;       // the $PATH command_dirs came from
+
+static pthread_t builder;
+static int building = 0;
+
+static hash_table_t listings;
+
+// Command trie
+
+static void trie_add(const char *name, int delta) {
+    trie_node_t *node = &trie_root;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        trie_node_t **link = &node->child;
+        while (*link && (*link)->c < *p) link = &(*link)->sibling;
+        if (!*link || (*link)->c != *p) {
+            if (delta < 0) return;
+            trie_node_t *fresh = calloc(1, sizeof(trie_node_t));
+            if (!fresh) return;
+            fresh->c = *p;
+            fresh->sibling = *link;
+            *link = fresh;
+        }
+        node = *link;
+    }
+    node->refs += delta;
+}
+
+static void free_trie(trie_node_t *node) {
+    while (node) {
+        trie_node_t *sibling = node->sibling;
+        free_trie(node->child);
+        free(node);
+        node = sibling;
+    }
+}
+
+static void add_match(match_list_t *matches, const char *text, size_t len) {
+    if (matches->count == matches->capacity) {
+        int capacity = matches->capacity ? matches->capacity * 2 : 16;
+        char **items = realloc(matches->items, capacity * sizeof(char*));
+        if (!items) return;
+        matches->items = items;
+        matches->capacity = capacity;
+    }
+    matches->items[matches->count++] = strndup(text, len);
+}
+
+// Every name in the subtree, in order; buf holds the path down to node
+static void collect_names(const trie_node_t *node, char **buf, size_t *size,
+                          size_t depth, match_list_t *matches) {
+    if (node->refs > 0) add_match(matches, *buf, depth);
+
+    for (const trie_node_t *child = node->child; child; child = child->sibling) {
+        if (depth + 2 > *size) {
+            *size *= 2;
+            *buf = realloc(*buf, *size);
+        }
+        (*buf)[depth] = child->c;
+        collect_names(child, buf, size, depth + 1, matches);
+    }
+}
+
+static void trie_matches(const char *prefix, match_list_t *matches) {
+    const trie_node_t *node = &trie_root;
+    for (const unsigned char *p = (const unsigned char *)prefix; *p && node; p++) {
+        node = node->child;
+        while (node && node->c < *p) node = node->sibling;
+        if (node && node->c != *p) node = NULL;
+    }
+    if (!node) return;
+
+    size_t len = strlen(prefix);
+    size_t size = len + 64;
+    char *buf = malloc(size);
+    memcpy(buf, prefix, len);
+    collect_names(node, &buf, &size, len, matches);
+    free(buf);
+}
+
+// PATH directories
+
+static void forget_dir(command_dir_t *dir) {
+    for (int i = 0; i < dir->count; i++) {
+        trie_add(dir->names[i], -1);
+        free(dir->names[i]);
+    }
+    free(dir->names);
+    dir->names = NULL;
+    dir->count = 0;
+}
+
+static void scan_dir(command_dir_t *dir) {
+    forget_dir(dir);
+
+    DIR *d = opendir(dir->path);
+    if (!d) return;
+
+    int capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(dirfd(d), entry->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode) ||
+            faccessat(dirfd(d), entry->d_name, X_OK, 0) != 0) {
+            continue;
+        }
+
+        if (dir->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **names = realloc(dir->names, capacity * sizeof(char*));
+            if (!names) break;
+            dir->names = names;
+        }
+        dir->names[dir->count++] = strdup(entry->d_name);
+        trie_add(entry->d_name, 1);
+    }
+    closedir(d);
+}
+
+// Bring the trie up to date with path: scan directories that are new or
+// whose mtime moved, and drop the ones no longer in it
+static void refresh_commands(const char *path) {
+    if (!command_path || strcmp(command_path, path) != 0) {
+        command_dir_t *old = command_dirs;
+        int old_count = command_dir_count;
+
+        int count = 1;
+        for (const char *p = path; *p; p++) {
+            if (*p == ':') count++;
+        }
+        command_dirs = calloc(count, sizeof(command_dir_t));
+        command_dir_count = 0;
+
+        const char *start = path;
+        for (;;) {
+            const char *end = strchr(start, ':');
+            size_t len = end ? (size_t)(end - start) : strlen(start);
+            char *dir_path = len ? strndup(start, len) : strdup(".");
+
+            // Keep what we know about directories PATH still has
+            command_dir_t *dir = &command_dirs[command_dir_count++];
+            dir->path = dir_path;
+            dir->mtime.tv_sec = -1;     // never scanned
+            for (int i = 0; i < old_count; i++) {
+                if (old[i].path && strcmp(old[i].path, dir_path) == 0) {
+                    dir->mtime = old[i].mtime;
+                    dir->names = old[i].names;
+                    dir->count = old[i].count;
+                    free(old[i].path);
+                    old[i].path = NULL;
+                    break;
+                }
+            }
+
+            if (!end) break;
+            start = end + 1;
+        }
+
+        for (int i = 0; i < old_count; i++) {
+            if (old[i].path) {
+                forget_dir(&old[i]);
+                free(old[i].path);
+            }
+        }
+        free(old);
+        free(command_path);
+        command_path = strdup(path);
+    }
+
+    for (int i = 0; i < command_dir_count; i++) {
+        command_dir_t *dir = &command_dirs[i];
+        struct stat st;
+        struct timespec mtime = { 0, 0 };
+        if (stat(dir->path, &st) == 0) mtime = st.st_mtim;
+
+        if (mtime.tv_sec != dir->mtime.tv_sec ||
+            mtime.tv_nsec != dir->mtime.tv_nsec) {
+            dir->mtime = mtime;
+            scan_dir(dir);
+        }
+    }
+}
+
+static void *build_commands(void *arg) {
+    char *path = arg;
+    refresh_commands(path);
+    free(path);
+    return NULL;
+}
+
+static void wait_for_builder(void) {
+    if (building) {
+        pthread_join(builder, NULL);
+        building = 0;
+    }
+}
+
+// Start building the command trie in the background, once
+void completion_prefetch(void) {
+    static int started = 0;
+    if (started) return;
+    started = 1;
+
+    char *path = getenv("PATH");
+    char *copy = strdup(path ? path : "");
+    if (copy && pthread_create(&builder, NULL, build_commands, copy) == 0) {
+        building = 1;
+    } else {
+        free(copy);
+    }
+}
+
+// Directory listings
+
+static void free_listing(void *value) {
+    dir_listing_t *listing = value;
+    for (size_t i = 0; i < listing->count; i++) {
+        free(listing->names[i]);
+    }
+    free(listing->names);
+    free(listing->kinds);
+    free(listing);
+}
+
+static dir_listing_t *read_listing(const char *path, struct timespec mtime) {
+    DIR *d = opendir(path);
+    if (!d) return NULL;
+
+    dir_listing_t *listing = calloc(1, sizeof(dir_listing_t));
+    size_t capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (listing->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            listing->names = realloc(listing->names, capacity * sizeof(char*));
+        }
+        listing->names[listing->count++] = strdup(entry->d_name);
+    }
+    closedir(d);
+
+    qsort(listing->names, listing->count, sizeof(char*), compare_strings);
+
+    // Kinds are filled in when a name is first offered
+    listing->kinds = malloc(listing->count ? listing->count : 1);
+    memset(listing->kinds, LISTING_UNKNOWN, listing->count);
+    listing->mtime = mtime;
+    return listing;
+}
+
+// The listing of path, from the cache unless the directory changed
+static dir_listing_t *get_listing(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) return NULL;
+
+    dir_listing_t *listing = hash_table_get(&listings, path);
+    if (listing && listing->mtime.tv_sec == st.st_mtim.tv_sec &&
+        listing->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        return listing;
+    }
+
+    if (!listing && listings.count >= LISTING_CACHE_MAX) {
+        hash_table_clear(&listings, free_listing);
+    }
+    dir_listing_t *fresh = read_listing(path, st.st_mtim);
+    if (fresh) {
+        listing = hash_table_put(&listings, path, fresh);
+    } else {
+        listing = hash_table_remove(&listings, path);
+    }
+    if (listing) free_listing(listing);
+    return fresh;
+}
+
+static int listing_is_dir(dir_listing_t *listing, size_t i, const char *dir) {
+    if (listing->kinds[i] == LISTING_UNKNOWN) {
+        struct stat st;
+        int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        int is_dir = fd != -1 && fstatat(fd, listing->names[i], &st, 0) == 0 &&
+                     S_ISDIR(st.st_mode);
+        if (fd != -1) close(fd);
+        listing->kinds[i] = is_dir ? LISTING_DIR : LISTING_FILE;
+    }
+    return listing->kinds[i] == LISTING_DIR;
+}
+
+// Files matching word, which may start with a directory part and ~/
+static void path_matches(const char *word, match_list_t *matches) {
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+    size_t dir_len = slash ? (size_t)(slash - word) + 1 : 0;
+
+    // The directory to list, with ~ expanded
+    char *dir;
+    if (!slash) {
+        dir = strdup(".");
+    } else if (word[0] == '~' && (word[1] == '/')) {
+        char *home = get_shell_var("HOME");
+        if (!home) home = "";
+        dir = malloc(strlen(home) + dir_len + 1);
+        sprintf(dir, "%s%.*s", home, (int)(dir_len - 1), word + 1);
+    } else {
+        dir = strndup(word, dir_len);
+    }
+
+    dir_listing_t *listing = get_listing(dir);
+    if (listing) {
+        size_t base_len = strlen(base);
+
+        // First name not below base
+        size_t lo = 0, hi = listing->count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (strcmp(listing->names[mid], base) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        for (size_t i = lo; i < listing->count; i++) {
+            const char *name = listing->names[i];
+            if (strncmp(name, base, base_len) != 0) break;
+            if (name[0] == '.' && base[0] != '.') continue;
+
+            size_t name_len = strlen(name);
+            char *text = malloc(dir_len + name_len + 2);
+            memcpy(text, word, dir_len);
+            memcpy(text + dir_len, name, name_len + 1);
+            if (listing_is_dir(listing, i, dir)) strcat(text, "/");
+            add_match(matches, text, strlen(text));
+            free(text);
+        }
+    }
+    free(dir);
+}
+
+// Sorted candidates for word, without duplicates. Directories end in '/'.
+// In command position a word without '/' is completed as a command name.
+char **complete_word(const char *word, int command_position, int *count) {
+    match_list_t matches = { NULL, 0, 0 };
+
+    if (command_position && !strchr(word, '/')) {
+        size_t len = strlen(word);
+        for (size_t i = 0; i < builtin_count; i++) {
+            if (strncmp(builtins[i].name, word, len) == 0) {
+                add_match(&matches, builtins[i].name, strlen(builtins[i].name));
+            }
+        }
+
+        size_t pos = 0;
+        const char *name;
+        while (hash_table_next(&alias_table, &pos, &name, NULL)) {
+            if (strncmp(name, word, len) == 0) add_match(&matches, name, strlen(name));
+        }
+        pos = 0;
+        while ((name = next_function_name(&pos)) != NULL) {
+            if (strncmp(name, word, len) == 0) add_match(&matches, name, strlen(name));
+        }
+
+        wait_for_builder();
+        char *path = getenv("PATH");
+        refresh_commands(path ? path : "");
+        trie_matches(word, &matches);
+    } else {
+        path_matches(word, &matches);
+    }
+
+    qsort(matches.items, matches.count, sizeof(char*), compare_strings);
+    int unique = 0;
+    for (int i = 0; i < matches.count; i++) {
+        if (unique > 0 && strcmp(matches.items[unique - 1], matches.items[i]) == 0) {
+            free(matches.items[i]);
+        } else {
+            matches.items[unique++] = matches.items[i];
+        }
+    }
+
+    *count = unique;
+    if (unique == 0) {
+        free(matches.items);
+        return NULL;
+    }
+    return matches.items;
+}
+
+void free_completion(void) {
+    wait_for_builder();
+    for (int i = 0; i < command_dir_count; i++) {
+        forget_dir(&command_dirs[i]);
+        free(command_dirs[i].path);
+    }
+    free(command_dirs);
+    command_dirs = NULL;
+    command_dir_count = 0;
+    free(command_path);
+    command_path = NULL;
+    free_trie(trie_root.child);
+    trie_root.child = NULL;
+    hash_table_clear(&listings, free_listing);
+}
@@ -0,0 +1,414 @@
+#include "shell.h"
+#include <sys/mman.h>
+
+// Tree-walking executor for parsed command lines
+
+static void write_node(FILE *out, node_t *node) {
+    static const char *redirect_ops[] = { "<", ">", ">>", "<<", "<<<" };
+
+    switch (node->type) {
+    case NODE_COMMAND:
+        for (int i = 0; node->words[i]; i++) {
+            fprintf(out, "%s%s", i > 0 ? " " : "", node->words[i]);
+        }
+        for (redirect_t *redir = node->redirects; redir; redir = redir->next) {
+            int default_fd = redir->type == REDIR_OUTPUT || redir->type == REDIR_APPEND;
+            fputc(' ', out);
+            if (redir->fd != default_fd) fprintf(out, "%d", redir->fd);
+            fprintf(out, "%s %s", redirect_ops[redir->type], redir->target);
+        }
+        break;
+    case NODE_PIPELINE:
+        for (int i = 0; i < node->nchildren; i++) {
+            if (i > 0) fputs(" | ", out);
+            write_node(out, node->children[i]);
+        }
+        break;
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_SEQUENCE:
+        write_node(out, node->left);
+        fputs(node->type == NODE_AND ? " && " : node->type == NODE_OR ? " || " : "; ", out);
+        write_node(out, node->right);
+        break;
+    case NODE_BACKGROUND:
+        write_node(out, node->left);
+        fputs(" &", out);
+        break;
+    case NODE_GROUP:
+        fputs("{ ", out);
+        write_node(out, node->left);
+        fputs("; }", out);
+        break;
+    case NODE_FUNCTION:
+        fprintf(out, "%s() ", node->words[0]);
+        write_node(out, node->left);
+        break;
+    case NODE_TIME:
+        fputs("time", out);
+        if (node->left) {
+            fputc(' ', out);
+            write_node(out, node->left);
+        }
+        break;
+    case NODE_WHILE:
+    case NODE_UNTIL:
+        fputs(node->type == NODE_WHILE ? "while " : "until ", out);
+        write_node(out, node->left);
+        fputs("; do ", out);
+        write_node(out, node->right);
+        fputs("; done", out);
+        break;
+    }
+}
+
+// Printable form of a command, for the job table
+char *node_text(node_t *node) {
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    if (!out) return strdup("");
+
+    write_node(out, node);
+    fclose(out);
+    return text;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+// A descriptor to read text from, for a here-document or here-string.
+// Text that fits in a pipe's buffer goes through a pipe, written in full
+// before anyone reads; anything larger goes into an anonymous memfd. It
+// never touches the filesystem.
+static int here_document_fd(const char *text, size_t len) {
+    int fds[2];
+    if (open_pipe(fds) == 0) {
+        int capacity = fcntl(fds[1], F_GETPIPE_SZ);
+        if (capacity > 0 && len <= (size_t)capacity &&
+            write_all(fds[1], text, len) == 0) {
+            close(fds[1]);
+            return fds[0];
+        }
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    int fd = memfd_create("here-document", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("memfd_create");
+        return -1;
+    }
+    if (write_all(fd, text, len) == -1 || lseek(fd, 0, SEEK_SET) == -1) {
+        perror("here-document");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Record a redirection of a descriptor other than stdin or stdout, in
+// place of any earlier one of the same descriptor. Takes ownership of file
+// and source.
+static void set_fd_redirect(fd_redirects_t *redirs, int fd, char *file, int flags, int source) {
+    fd_redirect_t *redir = &redirs->list[redirs->count];
+    for (int i = 0; i < redirs->count; i++) {
+        if (redirs->list[i].fd == fd) {
+            redir = &redirs->list[i];
+            free(redir->file);
+            if (redir->source != -1) close(redir->source);
+            break;
+        }
+    }
+    if (redir == &redirs->list[redirs->count]) redirs->count++;
+
+    redir->fd = fd;
+    redir->file = file;
+    redir->flags = flags;
+    redir->source = source;
+}
+
+void free_fd_redirects(fd_redirects_t *redirs) {
+    for (int i = 0; i < redirs->count; i++) {
+        free(redirs->list[i].file);
+        if (redirs->list[i].source != -1) close(redirs->list[i].source);
+    }
+    redirs->count = 0;
+}
+
+// Expand the redirections of a command. Input comes from *input_file or,
+// for a here-document or here-string, from *input_fd, which the caller
+// closes once the command has been started. Redirections of any other
+// descriptor, and of stdin or stdout the other way round (0>file), go in
+// *fd_redirects, which the caller releases with free_fd_redirects.
+// Returns -1, with nothing left to release, if an expansion failed.
+int expand_redirects(redirect_t *redir, char **input_file, int *input_fd, char **output_file, int *append,
+                      fd_redirects_t *fd_redirects) {
+    *input_file = NULL;
+    *input_fd = -1;
+    *output_file = NULL;
+    *append = 0;
+    fd_redirects->count = 0;
+
+    for (; redir; redir = redir->next) {
+        if (redir->type == REDIR_HEREDOC || redir->type == REDIR_HERESTRING) {
+            char *text;
+            if (redir->type == REDIR_HERESTRING) {
+                char *word = expand_word(redir->target);
+                if (!word) goto failed;
+                size_t len = strlen(word);
+                text = realloc(word, len + 2);
+                text[len] = '\n';
+                text[len + 1] = '\0';
+            } else {
+                text = redir->quoted ? strdup(redir->body) : expand_here_document(redir->body);
+                if (!text) goto failed;
+            }
+            int fd = here_document_fd(text, strlen(text));
+            free(text);
+
+            if (redir->fd != STDIN_FILENO) {
+                set_fd_redirect(fd_redirects, redir->fd, NULL, 0, fd);
+                continue;
+            }
+            free(*input_file);
+            *input_file = NULL;
+            if (*input_fd != -1) close(*input_fd);
+            *input_fd = fd;
+            continue;
+        }
+
+        char *target = expand_word(redir->target);
+        if (!target) goto failed;
+        if (redir->type == REDIR_INPUT && redir->fd == STDIN_FILENO) {
+            free(*input_file);
+            *input_file = target;
+            if (*input_fd != -1) {
+                close(*input_fd);
+                *input_fd = -1;
+            }
+        } else if (redir->type == REDIR_INPUT) {
+            set_fd_redirect(fd_redirects, redir->fd, target, O_RDONLY, -1);
+        } else if (redir->fd == STDOUT_FILENO) {
+            free(*output_file);
+            *output_file = target;
+            *append = redir->type == REDIR_APPEND;
+        } else {
+            int flags = O_WRONLY | O_CREAT | (redir->type == REDIR_APPEND ? O_APPEND : O_TRUNC);
+            set_fd_redirect(fd_redirects, redir->fd, target, flags, -1);
+        }
+    }
+    return 0;
+
+failed:
+    if (*input_fd != -1) close(*input_fd);
+    *input_fd = -1;
+    free(*input_file);
+    free(*output_file);
+    *input_file = *output_file = NULL;
+    free_fd_redirects(fd_redirects);
+    return -1;
+}
+
+// A command whose words or redirections can't be expanded isn't run
+static int expansion_failed(char **args) {
+    free_args(args);
+    last_exit_status = 1;
+    return last_exit_status;
+}
+
+static int execute_simple(node_t *cmd) {
+    char **args = expand_words(cmd->words);
+    char *input_file, *output_file;
+    int input_fd, append;
+    fd_redirects_t fd_redirects;
+    int keep_going = 1;
+
+    if (!args ||
+        expand_redirects(cmd->redirects, &input_file, &input_fd, &output_file, &append,
+                         &fd_redirects) == -1) {
+        return expansion_failed(args);
+    }
+
+    if (args[0]) {
+        if (input_file || input_fd != -1 || output_file || fd_redirects.count) {
+            keep_going = handle_redirection(args, input_file, input_fd, output_file, append,
+                                            &fd_redirects);
+        } else {
+            keep_going = execute_command(args);
+        }
+        if (!keep_going) exit_requested = 1;
+    }
+
+    if (input_fd != -1) close(input_fd);
+    free_fd_redirects(&fd_redirects);
+    free(input_file);
+    free(output_file);
+    free_args(args);
+    return last_exit_status;
+}
+
+// Whether a simple command runs a program, rather than shell code
+static int is_external(char *name) {
+    return !find_function(name) && !is_builtin(name) && !get_alias(name);
+}
+
+// Whether a background command can be spawned straight from the shell:
+// judged before anything is expanded, it names a program with a plain
+// word, and none of its words or redirections could change the shell's
+// state when expanded. Anything else is expanded in the subshell only.
+static int spawns_directly(node_t *node) {
+    if (node->type != NODE_COMMAND) return 0;
+
+    char *name = node->words[0];
+    if (!name || strpbrk(name, "'\"\\$`*?[") || !is_external(name)) return 0;
+
+    for (int i = 0; node->words[i]; i++) {
+        if (expansion_assigns(node->words[i])) return 0;
+    }
+    for (redirect_t *redir = node->redirects; redir; redir = redir->next) {
+        if (expansion_assigns(redir->target) ||
+            (redir->body && !redir->quoted && expansion_assigns(redir->body))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int execute_background(node_t *node) {
+    if (node->type == NODE_PIPELINE) {
+        return handle_pipes(node, 1);
+    }
+
+    char *text = node_text(node);
+    job_t *job = create_job(text, 0);
+    free(text);
+    if (!job) {
+        last_exit_status = 1;
+        return last_exit_status;
+    }
+
+    // A program is spawned directly; anything else runs in a subshell,
+    // which does its own expansion
+    spawn_req_t req;
+    char **args = NULL;
+    char *input_file = NULL, *output_file = NULL;
+    int input_fd = -1;
+    fd_redirects_t fd_redirects = { 0 };
+
+    if (spawns_directly(node)) {
+        args = expand_words(node->words);
+        if (!args) {
+            release_job(job);
+            return expansion_failed(args);
+        }
+        spawn_req_init(&req, args);
+        if (expand_redirects(node->redirects, &input_file, &input_fd, &output_file, &req.append,
+                             &fd_redirects) == -1) {
+            release_job(job);
+            return expansion_failed(args);
+        }
+        req.in_file = input_file;
+        req.in_fd = input_fd;
+        req.out_file = output_file;
+        req.fd_redirects = &fd_redirects;
+    } else {
+        spawn_req_init(&req, NULL);
+        req.shell_fn = run_node_in_child;
+        req.shell_arg = node;
+    }
+    req.job = job;
+
+    last_exit_status = spawn_process(&req) == -1 ? 127 : 0;
+    background_job(job);
+
+    if (input_fd != -1) close(input_fd);
+    free_fd_redirects(&fd_redirects);
+    free(input_file);
+    free(output_file);
+    free_args(args);
+    return last_exit_status;
+}
+
+// while runs the body as long as the condition succeeds, until as long as
+// it fails. The status is the body's last, or 0 if it never ran. A command
+// killed by Ctrl-C ends the loop, as it would end a script.
+static int execute_loop(node_t *node) {
+    int status = 0;
+
+    while (!exit_requested && !return_requested) {
+        int condition = execute_node(node->left);
+        if (condition == 128 + SIGINT) {
+            status = condition;
+            break;
+        }
+        if ((condition == 0) != (node->type == NODE_WHILE)) break;
+
+        status = execute_node(node->right);
+        if (status == 128 + SIGINT) break;
+    }
+
+    last_exit_status = status;
+    return status;
+}
+
+// Entry points for forked children that run shell code in a pipeline
+int run_node_in_child(void *node) {
+    execute_node(node);
+    return last_exit_status;
+}
+
+int run_command_in_child(void *args) {
+    execute_command(args);
+    return last_exit_status;
+}
+
+int execute_node(node_t *node) {
+    if (!node || exit_requested || return_requested) {
+        return last_exit_status;
+    }
+
+    int status;
+    switch (node->type) {
+    case NODE_COMMAND:
+        return execute_simple(node);
+    case NODE_PIPELINE:
+        return handle_pipes(node, 0);
+    case NODE_AND:
+        status = execute_node(node->left);
+        if (status == 0) status = execute_node(node->right);
+        return status;
+    case NODE_OR:
+        status = execute_node(node->left);
+        if (status != 0) status = execute_node(node->right);
+        return status;
+    case NODE_SEQUENCE:
+        execute_node(node->left);
+        return execute_node(node->right);
+    case NODE_BACKGROUND:
+        return execute_background(node->left);
+    case NODE_GROUP:
+        return execute_node(node->left);
+    case NODE_FUNCTION:
+        define_function(node);
+        last_exit_status = 0;
+        return 0;
+    case NODE_TIME:
+        return execute_timed(node->left);
+    case NODE_WHILE:
+    case NODE_UNTIL:
+        return execute_loop(node);
+    }
+
+    return last_exit_status;
+}
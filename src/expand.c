@@ -0,0 +1,488 @@
+#include "shell.h"
+
+// Word expansion: parameter expansion, command substitution, arithmetic
+// expansion, field splitting of unquoted expansions, quote removal and
+// pathname expansion, done in a single left-to-right pass over each word as
+// the parser stored it.
+//
+// For pathname expansion a field is built as a glob pattern: quoted
+// characters that mean something to the matcher get a backslash, and a
+// field is only handed to glob_pattern (see glob.c) if an unquoted * ? or
+// [ went into it. Otherwise, or if nothing matches, the backslashes are
+// taken out again.
+
+typedef struct str_buf {
+    char *data;
+    size_t len;
+    size_t capacity;
+} str_buf_t;
+
+typedef struct field_list {
+    char **fields;
+    int count;
+    int capacity;
+} field_list_t;
+
+// What went into the field being built
+typedef struct field_state {
+    int globbing;           // building a pattern (only when splitting fields)
+    int has_wildcard;       // an unquoted * ? or [
+    int escaped;            // a backslash was added to quote something
+} field_state_t;
+
+#define PLAIN_STOP "'\"\\$`*?["      // characters that start quoting or expansion
+
+static void buf_reserve(str_buf_t *buf, size_t extra) {
+    if (buf->len + extra + 1 <= buf->capacity) return;
+
+    size_t capacity = buf->capacity ? buf->capacity : 64;
+    while (buf->len + extra + 1 > capacity) capacity *= 2;
+
+    buf->data = realloc(buf->data, capacity);
+    if (!buf->data) {
+        fprintf(stderr, "allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    buf->capacity = capacity;
+}
+
+static void buf_append(str_buf_t *buf, const char *str, size_t len) {
+    buf_reserve(buf, len);
+    memcpy(buf->data + buf->len, str, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+static void buf_putc(str_buf_t *buf, char c) {
+    buf_reserve(buf, 1);
+    buf->data[buf->len++] = c;
+    buf->data[buf->len] = '\0';
+}
+
+static void fields_add(field_list_t *list, char *field) {
+    if (list->count + 1 >= list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : MAX_ARGS;
+        list->fields = realloc(list->fields, list->capacity * sizeof(char*));
+        if (!list->fields) {
+            fprintf(stderr, "allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    list->fields[list->count++] = field;
+}
+
+// Remove the backslashes that quoted pattern characters
+static void unescape_pattern(str_buf_t *buf) {
+    size_t out = 0;
+    for (size_t i = 0; i < buf->len; i++) {
+        if (buf->data[i] == '\\' && i + 1 < buf->len) i++;
+        buf->data[out++] = buf->data[i];
+    }
+    buf->len = out;
+    buf->data[out] = '\0';
+}
+
+// Finish the field in buf: its pathname matches if it has any, or the
+// field itself
+static void fields_push(field_list_t *list, str_buf_t *buf, field_state_t *state) {
+    if (state->has_wildcard) {
+        int count;
+        char **matches = glob_pattern(buf->data, &count);
+        if (matches) {
+            for (int i = 0; i < count; i++) fields_add(list, matches[i]);
+            free(matches);
+            free(buf->data);
+            buf->data = NULL;
+        }
+    }
+    if (buf->data && (state->has_wildcard || state->escaped)) {
+        unescape_pattern(buf);
+    }
+    if (buf->data || !state->has_wildcard) {
+        fields_add(list, buf->data ? buf->data : strdup(""));
+    }
+
+    buf->data = NULL;
+    buf->len = 0;
+    buf->capacity = 0;
+    state->has_wildcard = 0;
+    state->escaped = 0;
+}
+
+// Append text that has to stand for itself in a pattern
+static void buf_append_quoted(str_buf_t *buf, const char *str, size_t len, field_state_t *state) {
+    if (!state->globbing) {
+        buf_append(buf, str, len);
+        return;
+    }
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = str[i];
+        if (c == '*' || c == '?' || c == '[' || c == '\\') {
+            buf_append(buf, str + start, i - start);
+            buf_putc(buf, '\\');
+            state->escaped = 1;
+            start = i;
+        }
+    }
+    buf_append(buf, str + start, len - start);
+}
+
+// Append an unquoted character, which may be a wildcard
+static void buf_put_unquoted(str_buf_t *buf, char c, field_state_t *state) {
+    if (state->globbing && (c == '*' || c == '?' || c == '[')) {
+        state->has_wildcard = 1;
+    }
+    buf_putc(buf, c);
+}
+
+// Parse a $NAME, ${NAME} or special parameter reference at src (just past
+// the '$') and return its value. *end is set to the first character after
+// the reference. Values that have to be computed ($?, $#, $@, ...) are
+// built in scratch, which the caller reuses from one reference to the next.
+static const char *lookup_parameter(const char *src, const char **end, str_buf_t *scratch) {
+    const char *name = src;
+    size_t len;
+
+    if (*src == '{') {
+        name = ++src;
+        while (*src && *src != '}') src++;
+        len = src - name;
+        if (*src == '}') src++;
+    } else if (isalpha((unsigned char)*src) || *src == '_') {
+        while (isalnum((unsigned char)*src) || *src == '_') src++;
+        len = src - name;
+    } else {
+        // $1 is one digit, as are the specials; ${10} needs braces
+        len = *src ? 1 : 0;
+        src += len;
+    }
+    *end = src;
+    if (len == 0) return "";
+
+    if (len == 1 && strchr("?$!#@*", name[0])) {
+        char number[24];
+        scratch->len = 0;
+        buf_reserve(scratch, 0);
+        scratch->data[0] = '\0';
+        switch (name[0]) {
+        case '?':
+            snprintf(number, sizeof(number), "%d", last_exit_status);
+            break;
+        case '$':
+            snprintf(number, sizeof(number), "%d", (int)shell_pid);
+            break;
+        case '!':
+            if (!last_background_pid) return "";
+            snprintf(number, sizeof(number), "%d", (int)last_background_pid);
+            break;
+        case '#': {
+            int count = 0;
+            while (positional_params[count]) count++;
+            snprintf(number, sizeof(number), "%d", count);
+            break;
+        }
+        default:
+            // $@ and $* outside double quotes: the parameters joined by spaces
+            for (int i = 0; positional_params[i]; i++) {
+                if (i > 0) buf_putc(scratch, ' ');
+                buf_append(scratch, positional_params[i], strlen(positional_params[i]));
+            }
+            return scratch->data;
+        }
+        buf_append(scratch, number, strlen(number));
+        return scratch->data;
+    }
+
+    if (isdigit((unsigned char)name[0])) {
+        const char *param = get_positional_param(atoi(name));
+        return param ? param : "";
+    }
+
+    // The name is looked up in place when it can be terminated on the
+    // stack, and copied only when it is too long for that
+    char stack_name[256];
+    char *key = len < sizeof(stack_name) ? stack_name : malloc(len + 1);
+    memcpy(key, name, len);
+    key[len] = '\0';
+    char *value = get_shell_var(key);
+    if (key != stack_name) free(key);
+    return value ? value : "";
+}
+
+static int starts_parameter(const char *s) {
+    return s[0] == '$' && (s[1] == '{' || isalnum((unsigned char)s[1]) || s[1] == '_' ||
+                           (s[1] && strchr("?$!#@*", s[1])));
+}
+
+static int starts_expansion(const char *s) {
+    return *s == '`' || (s[0] == '$' && s[1] == '(') || starts_parameter(s);
+}
+
+// Run the $(...) or `...` at s and return its output, left in scratch.
+// *end is set past the closing ) or `.
+static const char *substitute_command(const char *s, const char **end, str_buf_t *scratch) {
+    const char *close = skip_substitution(s);
+    const char *stop;       // the closing ) or `, or the end if there is none
+    if (close) {
+        stop = close - 1;
+    } else {
+        close = stop = s + strlen(s);
+    }
+    *end = close;
+
+    // Strip the delimiters. Inside backquotes a backslash before a dollar
+    // sign, backquote or backslash only quotes it from the outer word.
+    str_buf_t code = { NULL, 0, 0 };
+    if (*s == '`') {
+        buf_reserve(&code, stop - s);
+        for (s++; s < stop; s++) {
+            if (*s == '\\' && s + 1 < stop && strchr("$`\\", s[1])) s++;
+            buf_putc(&code, *s);
+        }
+    } else {
+        buf_append(&code, s + 2, stop - (s + 2));
+    }
+
+    size_t len;
+    free(scratch->data);
+    scratch->data = command_substitution(code.data ? code.data : "", &len);
+    scratch->len = len;
+    scratch->capacity = len + 1;
+    free(code.data);
+    return scratch->data;
+}
+
+// Evaluate the $(( )) at s, which closes just before close, and leave the
+// result in scratch. References inside are expanded first; an expression
+// without any is looked up in the arithmetic cache as written. NULL if
+// the expression is in error, which has been reported.
+static const char *expand_arithmetic(const char *s, const char *close, str_buf_t *scratch) {
+    str_buf_t text = { NULL, 0, 0 };
+    buf_append(&text, s + 3, (close - 2) - (s + 3));
+
+    char *expr = text.data;
+    if (strpbrk(expr, "$`\\")) {
+        expr = expand_here_document(text.data);
+    }
+
+    long long value;
+    int failed = !expr || arith_evaluate(expr, &value) == -1;
+    if (expr != text.data) free(expr);
+    free(text.data);
+    if (failed) return NULL;
+
+    char number[24];
+    snprintf(number, sizeof(number), "%lld", value);
+    scratch->len = 0;
+    buf_append(scratch, number, strlen(number));
+    return scratch->data;
+}
+
+// Value of the parameter reference, command substitution or arithmetic
+// expansion at s, or NULL if it failed
+static const char *expansion_value(const char *s, const char **end, str_buf_t *scratch) {
+    if (s[0] == '$' && s[1] == '(' && s[2] == '(') {
+        const char *close = skip_substitution(s);
+        if (close && close - s >= 5 && close[-2] == ')') {
+            *end = close;
+            return expand_arithmetic(s, close, scratch);
+        }
+    }
+    if (*s == '`' || s[1] == '(') {
+        return substitute_command(s, end, scratch);
+    }
+    return lookup_parameter(s + 1, end, scratch);
+}
+
+// "$@" or "${@}" at s? Sets *end past it.
+static int quoted_all_params(const char *s, const char **end) {
+    if (strncmp(s, "$@", 2) == 0) {
+        *end = s + 2;
+        return 1;
+    }
+    if (strncmp(s, "${@}", 4) == 0) {
+        *end = s + 4;
+        return 1;
+    }
+    return 0;
+}
+
+// Expand one word. With a field list, unquoted expansions are split on
+// blanks and each resulting field is pushed; without one, the whole word
+// expands to the single string left in buf. Returns -1 if an expansion
+// failed, in which case the word is left part done.
+static int expand_into(const char *word, str_buf_t *buf, field_list_t *fields) {
+    const char *s = word;
+    int have_field = 0;     // quoting yields a field even when empty
+    field_state_t state = { fields != NULL, 0, 0 };
+    str_buf_t scratch = { NULL, 0, 0 };
+
+    buf_reserve(buf, strlen(word));
+
+    while (*s) {
+        if (*s == '\'') {
+            const char *close = strchr(s + 1, '\'');
+            if (!close) close = s + strlen(s);
+            buf_append_quoted(buf, s + 1, close - s - 1, &state);
+            s = *close ? close + 1 : close;
+            have_field = 1;
+        } else if (*s == '"') {
+            const char *after;
+            if (quoted_all_params(s + 1, &after) && *after == '"' && !positional_params[0]) {
+                // "$@" with no parameters is no field at all
+                s = after + 1;
+                continue;
+            }
+
+            s++;
+            while (*s && *s != '"') {
+                if (*s == '\\' && s[1] && strchr("$`\"\\", s[1])) {
+                    buf_append_quoted(buf, s + 1, 1, &state);
+                    s += 2;
+                } else if (*s == '$' && quoted_all_params(s, &after)) {
+                    // "$@": each parameter is a field of its own
+                    for (int i = 0; positional_params[i]; i++) {
+                        if (i > 0) {
+                            if (fields) {
+                                fields_push(fields, buf, &state);
+                            } else {
+                                buf_putc(buf, ' ');
+                            }
+                        }
+                        buf_append_quoted(buf, positional_params[i], strlen(positional_params[i]), &state);
+                    }
+                    s = after;
+                } else if (starts_expansion(s)) {
+                    const char *value = expansion_value(s, &s, &scratch);
+                    if (!value) goto failed;
+                    buf_append_quoted(buf, value, strlen(value), &state);
+                } else {
+                    size_t run = strcspn(s + 1, "\"\\$`") + 1;
+                    buf_append_quoted(buf, s, run, &state);
+                    s += run;
+                }
+            }
+            if (*s == '"') s++;
+            have_field = 1;
+        } else if (*s == '\\' && s[1]) {
+            buf_append_quoted(buf, s + 1, 1, &state);
+            s += 2;
+            have_field = 1;
+        } else if (starts_expansion(s)) {
+            const char *value = expansion_value(s, &s, &scratch);
+            if (!value) goto failed;
+            if (!fields) {
+                buf_append(buf, value, strlen(value));
+                continue;
+            }
+            for (; *value; value++) {
+                if (*value == ' ' || *value == '\t' || *value == '\n') {
+                    if (buf->len > 0 || have_field) {
+                        fields_push(fields, buf, &state);
+                        have_field = 0;
+                    }
+                } else if (*value == '\\') {
+                    buf_append_quoted(buf, value, 1, &state);
+                } else {
+                    buf_put_unquoted(buf, *value, &state);
+                }
+            }
+        } else {
+            // A run of characters that mean nothing to expansion goes in whole
+            size_t run = strcspn(s, PLAIN_STOP);
+            if (run == 0) {
+                buf_put_unquoted(buf, *s++, &state);
+            } else {
+                buf_append(buf, s, run);
+                s += run;
+            }
+            have_field = 1;
+        }
+    }
+
+    if (fields && (buf->len > 0 || have_field)) {
+        fields_push(fields, buf, &state);
+    }
+    free(scratch.data);
+    return 0;
+
+failed:
+    free(scratch.data);
+    return -1;
+}
+
+// Could expanding word change the shell's state? Only arithmetic expansion
+// assigns, but it can do so through a variable whose value is an
+// expression, so any $(( )) counts.
+int expansion_assigns(const char *word) {
+    return strstr(word, "$((") != NULL;
+}
+
+// The fields of words, NULL-terminated, or NULL if an expansion failed
+char **expand_words(char **words) {
+    field_list_t fields = { NULL, 0, 0 };
+    str_buf_t buf = { NULL, 0, 0 };
+
+    for (int i = 0; words[i]; i++) {
+        // Most words have nothing to expand and are taken as they are
+        if (!strpbrk(words[i], PLAIN_STOP)) {
+            fields_add(&fields, strdup(words[i]));
+            continue;
+        }
+        if (expand_into(words[i], &buf, &fields) == -1) {
+            fields_add(&fields, NULL);
+            free_args(fields.fields);
+            free(buf.data);
+            return NULL;
+        }
+    }
+    free(buf.data);
+
+    if (!fields.fields) {
+        fields.fields = malloc(sizeof(char*));
+    }
+    fields.fields[fields.count] = NULL;
+    return fields.fields;
+}
+
+// word as a single string, or NULL if an expansion failed
+char *expand_word(const char *word) {
+    str_buf_t buf = { NULL, 0, 0 };
+    if (expand_into(word, &buf, NULL) == -1) {
+        free(buf.data);
+        return NULL;
+    }
+    return buf.data ? buf.data : strdup("");
+}
+
+// Expand the body of a here-document: parameters and command substitutions
+// are expanded, and a backslash quotes $ ` \ or a newline; quotes and
+// everything else are text. NULL if an expansion failed.
+char *expand_here_document(const char *body) {
+    str_buf_t buf = { NULL, 0, 0 };
+    str_buf_t scratch = { NULL, 0, 0 };
+    buf_reserve(&buf, strlen(body));
+
+    const char *s = body;
+    while (*s) {
+        if (*s == '\\' && s[1] == '\n') {
+            s += 2;
+        } else if (*s == '\\' && s[1] && strchr("$`\\", s[1])) {
+            buf_putc(&buf, s[1]);
+            s += 2;
+        } else if (starts_expansion(s)) {
+            const char *value = expansion_value(s, &s, &scratch);
+            if (!value) {
+                free(scratch.data);
+                free(buf.data);
+                return NULL;
+            }
+            buf_append(&buf, value, strlen(value));
+        } else {
+            buf_putc(&buf, *s++);
+        }
+    }
+    free(scratch.data);
+    return buf.data ? buf.data : strdup("");
+}
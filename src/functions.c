@@ -0,0 +1,219 @@
+#include "shell.h"
+
+// Shell functions and sourced scripts, both parsed exactly once. A function
+// keeps a reference to the parse tree its definition came from and runs the
+// body node directly on every call. Sourced files are cached by path and
+// reparsed only when the file's mtime or size changes.
+
+struct shell_function {
+    parse_tree_t *tree;
+    node_t *body;
+};
+
+typedef struct script_entry {
+    parse_tree_t *tree;
+    struct timespec mtime;
+    off_t size;
+} script_entry_t;
+
+static hash_table_t function_table;
+static hash_table_t script_cache;
+static int call_depth = 0;  // functions and sourced files currently running
+
+static char *no_params[] = { NULL };
+char *shell_name = "shell";
+char **positional_params = no_params;
+int return_requested = 0;
+
+void set_positional_params(char *name, char **params) {
+    shell_name = name;
+    positional_params = params ? params : no_params;
+}
+
+const char *get_positional_param(int n) {
+    if (n == 0) return shell_name;
+
+    for (int i = 0; i < n; i++) {
+        if (!positional_params[i]) return NULL;
+    }
+    return positional_params[n - 1];
+}
+
+static void free_function(void *value) {
+    shell_function_t *fn = value;
+    free_parse_tree(fn->tree);
+    free(fn);
+}
+
+void define_function(node_t *def) {
+    shell_function_t *fn = malloc(sizeof(shell_function_t));
+    if (!fn) {
+        perror("malloc");
+        return;
+    }
+
+    retain_parse_tree(def->tree);
+    fn->tree = def->tree;
+    fn->body = def->left;
+
+    shell_function_t *old = hash_table_put(&function_table, def->words[0], fn);
+    if (old) free_function(old);
+}
+
+shell_function_t *find_function(const char *name) {
+    return hash_table_get(&function_table, name);
+}
+
+node_t *function_body(shell_function_t *fn) {
+    return fn->body;
+}
+
+// Walk the defined function names; start with *pos = 0
+const char *next_function_name(size_t *pos) {
+    const char *name;
+    return hash_table_next(&function_table, pos, &name, NULL) ? name : NULL;
+}
+
+// Run the body with args[1..] as positional parameters
+int call_function(shell_function_t *fn, char **args) {
+    char **saved_params = positional_params;
+    parse_tree_t *tree = fn->tree;
+
+    // Hold the tree in case the body redefines the function
+    retain_parse_tree(tree);
+    positional_params = args + 1;
+    call_depth++;
+
+    execute_node(fn->body);
+
+    call_depth--;
+    return_requested = 0;
+    positional_params = saved_params;
+    free_parse_tree(tree);
+
+    return !exit_requested;
+}
+
+static void free_script_entry(void *value) {
+    script_entry_t *entry = value;
+    free_parse_tree(entry->tree);
+    free(entry);
+}
+
+static char *read_file(int fd, size_t size) {
+    char *buf = malloc(size + 1);
+    if (!buf) return NULL;
+
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = read(fd, buf + total, size - total);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+        total += n;
+    }
+    buf[total] = '\0';
+    return buf;
+}
+
+// Return the parsed form of a script, from the cache when the file is
+// unchanged. The cache holds its own reference to the tree.
+static parse_tree_t *load_script(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror(path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror(path);
+        close(fd);
+        return NULL;
+    }
+
+    script_entry_t *entry = hash_table_get(&script_cache, path);
+    if (entry && entry->size == st.st_size &&
+        entry->mtime.tv_sec == st.st_mtim.tv_sec &&
+        entry->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        close(fd);
+        return entry->tree;
+    }
+
+    char *source = read_file(fd, st.st_size);
+    close(fd);
+    if (!source) {
+        perror(path);
+        return NULL;
+    }
+
+    int status;
+    parse_tree_t *tree = parse_command_line(source, &status);
+    free(source);
+    if (!tree) {
+        if (status == PARSE_INCOMPLETE) {
+            fprintf(stderr, "shell: %s: syntax error: unexpected end of file\n", path);
+        }
+        return NULL;
+    }
+
+    entry = malloc(sizeof(script_entry_t));
+    entry->tree = tree;
+    entry->mtime = st.st_mtim;
+    entry->size = st.st_size;
+
+    script_entry_t *old = hash_table_put(&script_cache, path, entry);
+    if (old) free_script_entry(old);
+    return tree;
+}
+
+// Execute a script file in the current shell. Returns -1 if it could not
+// be loaded, otherwise the status of its last command.
+int source_file(const char *path, char **params) {
+    parse_tree_t *tree = load_script(path);
+    if (!tree) {
+        last_exit_status = 1;
+        return -1;
+    }
+
+    char **saved_params = positional_params;
+    retain_parse_tree(tree);
+    if (params) positional_params = params;
+    call_depth++;
+
+    execute_node(tree->root);
+
+    call_depth--;
+    return_requested = 0;
+    positional_params = saved_params;
+    free_parse_tree(tree);
+
+    return last_exit_status;
+}
+
+void free_functions(void) {
+    hash_table_clear(&function_table, free_function);
+    hash_table_clear(&script_cache, free_script_entry);
+}
+
+int cmd_return(char **args) {
+    if (call_depth == 0) {
+        fprintf(stderr, "return: can only `return' from a function or sourced script\n");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    last_exit_status = args[1] ? atoi(args[1]) & 0xff : last_exit_status;
+    return_requested = 1;
+    return 1;
+}
+
+int cmd_source(char **args) {
+    if (!args[1]) {
+        printf("Usage: source file [args]\n");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    source_file(args[1], args[2] ? args + 2 : NULL);
+    return !exit_requested;
+}
@@ -0,0 +1,441 @@
+#include "shell.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+// Pathname expansion.
+//
+// A pattern is split on '/' into components once. Literal components are
+// appended without touching the disk; the rest are matched against each
+// directory's entries as getdents64 returns them, straight out of the
+// kernel's buffer, so no string is built for an entry that doesn't match.
+// Patterns use * ? [...] (with ! or ^ to negate) and backslash escapes;
+// a leading '.' must be matched explicitly. A `**` component matches any
+// number of directories, including none; it doesn't descend into hidden
+// directories or follow symlinks. A pattern ending in `**/` matches only
+// directories: the one before the `**` and every one below it.
+//
+// Directories waiting to be read go on a shared queue. A pattern that
+// has to descend (a wildcard before the last '/' or a `**`) is worked on
+// by a pool of threads, one per CPU up to GLOB_MAX_THREADS, each keeping
+// its own matches; they are merged and sorted at the end.
+
+#define GLOB_MAX_THREADS 8
+#define GLOB_DENTS_BUFFER (256 * 1024)
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct glob_component {
+    const char *start;
+    size_t len;
+    int literal;            // no wildcards: used as it stands
+    int globstar;           // the whole component is **
+} glob_component_t;
+
+typedef struct glob_work {
+    char *prefix;           // directory to read, as it appears in matches ("" or ending in '/')
+    int component;          // first component still to match
+    int star;               // inside a **: also descend into every subdirectory
+} glob_work_t;
+
+typedef struct glob_matches {
+    char **items;
+    int count;
+    int capacity;
+} glob_matches_t;
+
+typedef struct glob_run {
+    glob_component_t *components;
+    int ncomponents;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    glob_work_t *queue;
+    int queued;
+    int queue_capacity;
+    int busy;               // workers holding an item
+} glob_run_t;
+
+typedef struct glob_worker {
+    glob_run_t *run;
+    glob_matches_t matches;
+    char *dents;
+} glob_worker_t;
+
+// Matching
+
+static size_t utf8_length(const char *s) {
+    size_t len = 1;
+    while ((s[len] & 0xc0) == 0x80) len++;
+    return len;
+}
+
+// Match c against the bracket expression at p. Returns 1 or 0 and sets
+// *after past the closing ']', or -1 if the bracket is never closed (and
+// so is an ordinary character).
+static int match_bracket(const char *p, const char *end, unsigned char c, const char **after) {
+    const char *q = p + 1;
+    int negate = 0;
+    int matched = 0;
+
+    if (q < end && (*q == '!' || *q == '^')) {
+        negate = 1;
+        q++;
+    }
+    for (int first = 1; ; first = 0) {
+        if (q >= end) return -1;
+        if (*q == ']' && !first) break;
+
+        if (*q == '\\' && q + 1 < end) q++;
+        unsigned char lo = *q++;
+        unsigned char hi = lo;
+        if (q + 1 < end && *q == '-' && q[1] != ']') {
+            q++;
+            if (*q == '\\' && q + 1 < end) q++;
+            hi = *q++;
+        }
+        if (c >= lo && c <= hi) matched = 1;
+    }
+    *after = q + 1;
+    return matched != negate;
+}
+
+// Does name match the pattern component [p, end)?
+static int match_component(const char *p, const char *end, const char *name) {
+    if (*name == '.' && !(p < end && (*p == '.' || (*p == '\\' && p + 1 < end && p[1] == '.')))) {
+        return 0;
+    }
+
+    const char *star_p = NULL;
+    const char *star_n = NULL;
+    const char *n = name;
+    while (*n) {
+        if (p < end) {
+            if (*p == '*') {
+                star_p = ++p;
+                star_n = n;
+                continue;
+            }
+            if (*p == '?') {
+                p++;
+                n += utf8_length(n);
+                continue;
+            }
+            if (*p == '[') {
+                const char *after;
+                int m = match_bracket(p, end, *n, &after);
+                if (m == 1) {
+                    p = after;
+                    n++;
+                    continue;
+                }
+                if (m == 0) goto mismatch;
+            }
+            const char *lit = p;
+            if (*lit == '\\' && lit + 1 < end) lit++;
+            if (*lit == *n) {
+                p = lit + 1;
+                n++;
+                continue;
+            }
+        }
+    mismatch:
+        if (!star_p) return 0;
+        p = star_p;
+        n = ++star_n;
+    }
+    while (p < end && *p == '*') p++;
+    return p == end;
+}
+
+// Does the pattern have any wildcard outside a backslash escape?
+static int glob_has_wildcard(const char *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == '\\') {
+            i++;
+        } else if (p[i] == '*' || p[i] == '?' || p[i] == '[') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Results and work
+
+static void add_match(glob_matches_t *matches, char *path) {
+    if (matches->count == matches->capacity) {
+        int capacity = matches->capacity ? matches->capacity * 2 : 64;
+        char **items = realloc(matches->items, capacity * sizeof(char*));
+        if (!items) {
+            free(path);
+            return;
+        }
+        matches->items = items;
+        matches->capacity = capacity;
+    }
+    matches->items[matches->count++] = path;
+}
+
+// prefix + name (+ "/" when dir), with backslash escapes removed from name
+// if it came from the pattern
+static char *join_path(const char *prefix, const char *name, size_t len, int unescape, int dir) {
+    size_t prefix_len = strlen(prefix);
+    char *path = malloc(prefix_len + len + 2);
+    memcpy(path, prefix, prefix_len);
+    size_t out = prefix_len;
+    for (size_t i = 0; i < len; i++) {
+        if (unescape && name[i] == '\\' && i + 1 < len) i++;
+        path[out++] = name[i];
+    }
+    if (dir) path[out++] = '/';
+    path[out] = '\0';
+    return path;
+}
+
+static void push_work(glob_run_t *run, char *prefix, int component, int star) {
+    pthread_mutex_lock(&run->lock);
+    if (run->queued == run->queue_capacity) {
+        int capacity = run->queue_capacity ? run->queue_capacity * 2 : 64;
+        glob_work_t *queue = realloc(run->queue, capacity * sizeof(glob_work_t));
+        if (!queue) {
+            pthread_mutex_unlock(&run->lock);
+            free(prefix);
+            return;
+        }
+        run->queue = queue;
+        run->queue_capacity = capacity;
+    }
+    run->queue[run->queued].prefix = prefix;
+    run->queue[run->queued].component = component;
+    run->queue[run->queued].star = star;
+    run->queued++;
+    pthread_cond_signal(&run->wake);
+    pthread_mutex_unlock(&run->lock);
+}
+
+// Carry on from directory prefix at component k: literal components are
+// appended directly, and the first wildcard means reading the directory
+static void descend(glob_worker_t *worker, char *prefix, int k) {
+    glob_run_t *run = worker->run;
+
+    while (k < run->ncomponents - 1 && run->components[k].literal) {
+        glob_component_t *c = &run->components[k];
+        char *longer = join_path(prefix, c->start, c->len, 1, 1);
+        free(prefix);
+        prefix = longer;
+        k++;
+    }
+
+    glob_component_t *c = &run->components[k];
+    if (c->literal) {
+        // Last component: the match is whatever exists
+        char *path = join_path(prefix, c->start, c->len, 1, 0);
+        struct stat st;
+        if (lstat(path[0] ? path : ".", &st) == 0) {
+            add_match(&worker->matches, path);
+        } else {
+            free(path);
+        }
+        free(prefix);
+    } else if (c->globstar) {
+        // Consecutive ** are one
+        while (k + 1 < run->ncomponents && run->components[k + 1].globstar) k++;
+        // A trailing ** matches everything below; otherwise what follows
+        // is matched in this directory and every one under it
+        int next = k + 1 < run->ncomponents ? k + 1 : k;
+        struct stat st;
+        if (run->components[next].len == 0 && prefix[0] &&
+            stat(prefix, &st) == 0 && S_ISDIR(st.st_mode)) {
+            // **/ matching no directories at all leaves the one before it
+            add_match(&worker->matches, strdup(prefix));
+        }
+        push_work(run, prefix, next, 1);
+    } else {
+        push_work(run, prefix, k, 0);
+    }
+}
+
+static int entry_is_dir(int dirfd, const struct linux_dirent64 *entry, int follow) {
+    if (entry->d_type == DT_DIR) return 1;
+    if (entry->d_type != DT_UNKNOWN && !(entry->d_type == DT_LNK && follow)) return 0;
+
+    struct stat st;
+    return fstatat(dirfd, entry->d_name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 &&
+           S_ISDIR(st.st_mode);
+}
+
+// Match component k against every entry of the directory prefix; with
+// star, also queue each subdirectory to be matched the same way
+static void scan_directory(glob_worker_t *worker, const char *prefix, int k, int star) {
+    glob_run_t *run = worker->run;
+    glob_component_t *c = &run->components[k];
+    const char *end = c->start + c->len;
+    int last = k == run->ncomponents - 1;
+    int dirs_only = star && c->len == 0;    // the empty component after **/
+
+    int fd = open(prefix[0] ? prefix : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, worker->dents, GLOB_DENTS_BUFFER);
+        if (n <= 0) break;
+
+        for (long pos = 0; pos < n; ) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(worker->dents + pos);
+            pos += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            size_t len = 0;
+            if (star && name[0] != '.' && entry_is_dir(fd, entry, 0)) {
+                len = strlen(name);
+                push_work(run, join_path(prefix, name, len, 0, 1), k, 1);
+            }
+            if (dirs_only) {
+                // Links to directories match here, though they aren't descended into
+                if (name[0] != '.' && entry_is_dir(fd, entry, 1)) {
+                    if (!len) len = strlen(name);
+                    add_match(&worker->matches, join_path(prefix, name, len, 0, 1));
+                }
+                continue;
+            }
+
+            if (!match_component(c->start, end, name)) continue;
+            if (!len) len = strlen(name);
+            if (last) {
+                add_match(&worker->matches, join_path(prefix, name, len, 0, 0));
+            } else if (entry_is_dir(fd, entry, 1)) {
+                descend(worker, join_path(prefix, name, len, 0, 1), k + 1);
+            }
+        }
+    }
+    close(fd);
+}
+
+static void *glob_worker(void *arg) {
+    glob_worker_t *worker = arg;
+    glob_run_t *run = worker->run;
+
+    pthread_mutex_lock(&run->lock);
+    for (;;) {
+        if (run->queued == 0) {
+            if (run->busy == 0) break;
+            pthread_cond_wait(&run->wake, &run->lock);
+            continue;
+        }
+
+        glob_work_t work = run->queue[--run->queued];
+        run->busy++;
+        pthread_mutex_unlock(&run->lock);
+
+        scan_directory(worker, work.prefix, work.component, work.star);
+        free(work.prefix);
+
+        pthread_mutex_lock(&run->lock);
+        run->busy--;
+        if (run->queued == 0 && run->busy == 0) {
+            pthread_cond_broadcast(&run->wake);
+        }
+    }
+    pthread_mutex_unlock(&run->lock);
+    return NULL;
+}
+
+static int glob_threads(void) {
+    cpu_set_t set;
+    int n = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : 1;
+    if (n > GLOB_MAX_THREADS) n = GLOB_MAX_THREADS;
+    return n > 0 ? n : 1;
+}
+
+// Sorted paths matching pattern (with backslash escapes), or NULL if none
+char **glob_pattern(const char *pattern, int *count) {
+    glob_run_t run;
+    memset(&run, 0, sizeof(run));
+
+    // Components; an absolute pattern starts from "/"
+    const char *p = pattern;
+    char *root = strdup("");
+    if (*p == '/') {
+        free(root);
+        root = strdup("/");
+        while (*p == '/') p++;
+    }
+    int max = 1;
+    for (const char *s = p; *s; s++) {
+        if (*s == '/') max++;
+    }
+    run.components = malloc(max * sizeof(glob_component_t));
+    int needs_descent = 0;
+    for (;;) {
+        const char *slash = strchr(p, '/');
+        size_t len = slash ? (size_t)(slash - p) : strlen(p);
+        glob_component_t *c = &run.components[run.ncomponents++];
+        c->start = p;
+        c->len = len;
+        c->literal = !glob_has_wildcard(p, len);
+        c->globstar = len == 2 && p[0] == '*' && p[1] == '*';
+        if (c->globstar || (!c->literal && slash)) needs_descent = 1;
+        if (!slash) break;
+        p = slash + 1;
+        while (*p == '/') p++;      // a//b is a/b
+    }
+
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.wake, NULL);
+
+    int nworkers = needs_descent ? glob_threads() : 1;
+    glob_worker_t *workers = calloc(nworkers, sizeof(glob_worker_t));
+    pthread_t *threads = malloc(nworkers * sizeof(pthread_t));
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].run = &run;
+        workers[i].dents = malloc(GLOB_DENTS_BUFFER);
+    }
+
+    // The first steps happen here; anything needing a directory read goes
+    // through the queue
+    descend(&workers[0], root, 0);
+
+    int started = 1;
+    for (int i = 1; i < nworkers; i++) {
+        if (pthread_create(&threads[i], NULL, glob_worker, &workers[i]) != 0) break;
+        started++;
+    }
+    glob_worker(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    glob_matches_t all = workers[0].matches;
+    for (int i = 1; i < nworkers; i++) {
+        glob_matches_t *m = &workers[i].matches;
+        for (int j = 0; j < m->count; j++) add_match(&all, m->items[j]);
+        free(m->items);
+    }
+    for (int i = 0; i < nworkers; i++) free(workers[i].dents);
+    free(workers);
+    free(threads);
+    free(run.queue);
+    free(run.components);
+    pthread_mutex_destroy(&run.lock);
+    pthread_cond_destroy(&run.wake);
+
+    *count = all.count;
+    if (all.count == 0) {
+        free(all.items);
+        return NULL;
+    }
+    qsort(all.items, all.count, sizeof(char*), compare_strings);
+    return all.items;
+}
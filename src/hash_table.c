@@ -0,0 +1,140 @@
+#include "shell.h"
+
+// Open-addressing string hash table with linear probing. Keys are copied
+// on insert; values are opaque and owned by the caller. Deleted slots are
+// marked with a tombstone and reclaimed when the table is rebuilt.
+
+#define HASH_TABLE_MIN_CAPACITY 16
+
+static char tombstone_key;
+#define TOMBSTONE (&tombstone_key)
+
+static unsigned int hash_string(const char *key) {
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void hash_table_init(hash_table_t *table) {
+    table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->used = 0;
+}
+
+// Find the slot holding key, or the slot where it should be inserted
+static hash_entry_t *find_slot(const hash_table_t *table, const char *key,
+                               unsigned int hash) {
+    size_t mask = table->capacity - 1;
+    size_t index = hash & mask;
+    hash_entry_t *first_tombstone = NULL;
+
+    for (;;) {
+        hash_entry_t *entry = &table->entries[index];
+        if (entry->key == NULL) {
+            return first_tombstone ? first_tombstone : entry;
+        }
+        if (entry->key == TOMBSTONE) {
+            if (!first_tombstone) first_tombstone = entry;
+        } else if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static void resize(hash_table_t *table, size_t capacity) {
+    hash_entry_t *old_entries = table->entries;
+    size_t old_capacity = table->capacity;
+
+    table->entries = calloc(capacity, sizeof(hash_entry_t));
+    if (!table->entries) {
+        fprintf(stderr, "allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    table->capacity = capacity;
+    table->used = table->count;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        hash_entry_t *entry = &old_entries[i];
+        if (entry->key && entry->key != TOMBSTONE) {
+            *find_slot(table, entry->key, entry->hash) = *entry;
+        }
+    }
+    free(old_entries);
+}
+
+void *hash_table_get(const hash_table_t *table, const char *key) {
+    if (table->count == 0) return NULL;
+
+    hash_entry_t *entry = find_slot(table, key, hash_string(key));
+    return (entry->key && entry->key != TOMBSTONE) ? entry->value : NULL;
+}
+
+void *hash_table_put(hash_table_t *table, const char *key, void *value) {
+    // Keep the load (live entries plus tombstones) under 3/4
+    if ((table->used + 1) * 4 > table->capacity * 3) {
+        size_t capacity = table->capacity ? table->capacity : HASH_TABLE_MIN_CAPACITY;
+        while ((table->count + 1) * 2 > capacity) capacity *= 2;
+        resize(table, capacity);
+    }
+
+    unsigned int hash = hash_string(key);
+    hash_entry_t *entry = find_slot(table, key, hash);
+
+    if (entry->key && entry->key != TOMBSTONE) {
+        void *old = entry->value;
+        entry->value = value;
+        return old;
+    }
+
+    if (entry->key == NULL) table->used++;
+    entry->key = strdup(key);
+    entry->hash = hash;
+    entry->value = value;
+    table->count++;
+    return NULL;
+}
+
+void *hash_table_remove(hash_table_t *table, const char *key) {
+    if (table->count == 0) return NULL;
+
+    hash_entry_t *entry = find_slot(table, key, hash_string(key));
+    if (!entry->key || entry->key == TOMBSTONE) return NULL;
+
+    void *value = entry->value;
+    free(entry->key);
+    entry->key = TOMBSTONE;
+    entry->value = NULL;
+    table->count--;
+    return value;
+}
+
+int hash_table_next(const hash_table_t *table, size_t *pos,
+                    const char **key, void **value) {
+    while (*pos < table->capacity) {
+        hash_entry_t *entry = &table->entries[(*pos)++];
+        if (entry->key && entry->key != TOMBSTONE) {
+            if (key) *key = entry->key;
+            if (value) *value = entry->value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void hash_table_clear(hash_table_t *table, void (*free_value)(void *)) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        hash_entry_t *entry = &table->entries[i];
+        if (entry->key && entry->key != TOMBSTONE) {
+            free(entry->key);
+            if (free_value) free_value(entry->value);
+        }
+    }
+    free(table->entries);
+    hash_table_init(table);
+}
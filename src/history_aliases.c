@@ -1,151 +1,444 @@
 #include "shell.h"
+#include <sys/file.h>
+#include <sys/mman.h>
+
+// History file descriptor, open for appending for the whole session
+static int history_fd = -1;
+static char history_path[1024];
 
 // History functions
+
+// Store an already allocated entry in the ring
+static void history_push(char *entry) {
+    if (!history.entries) {
+        history_set_size(DEFAULT_HISTSIZE);
+    }
+    if (history.capacity == 0) {
+        free(entry);
+        return;
+    }
+    
+    int slot = (history.start + history.count) % history.capacity;
+    if (history.count == history.capacity) {
+        // Full: overwrite the oldest entry
+        free(history.entries[slot]);
+        history.start = (history.start + 1) % history.capacity;
+        history.base++;
+    } else {
+        history.count++;
+    }
+    history.entries[slot] = entry;
+    history_index_add(history.base + history.count - 1, entry);
+}
+
+// Lock the history file. Compaction replaces the file by renaming a new
+// one over it, so once the lock is held, make sure history_fd is still the
+// file at the path, and move to the new one if it isn't.
+static int lock_history(int operation) {
+    for (int tries = 0; tries < 8; tries++) {
+        if (flock(history_fd, operation) == -1) return -1;
+        
+        struct stat held, current;
+        if (fstat(history_fd, &held) == 0 && stat(history_path, &current) == 0 &&
+            held.st_dev == current.st_dev && held.st_ino == current.st_ino) {
+            return 0;
+        }
+        
+        int fd = open(history_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            flock(history_fd, LOCK_UN);
+            return -1;
+        }
+        close(history_fd);
+        history_fd = fd;
+    }
+    return -1;
+}
+
+// Append one entry to the history file as a single O_APPEND write. Each
+// entry is one line of the file: a backslash or newline in it is written
+// as \\ or \n. The shared lock only keeps us out of another shell's
+// compaction; appenders never block each other.
+static void append_history_line(const char *line) {
+    size_t len = strlen(line);
+    char *buf = malloc(2 * len + 1);
+    if (!buf) return;
+    
+    size_t out = 0;
+    for (const char *s = line; *s; s++) {
+        if (*s == '\\' || *s == '\n') {
+            buf[out++] = '\\';
+            buf[out++] = *s == '\n' ? 'n' : '\\';
+        } else {
+            buf[out++] = *s;
+        }
+    }
+    buf[out++] = '\n';
+    
+    if (lock_history(LOCK_SH) == 0) {
+        if (write(history_fd, buf, out) == -1) {
+            perror("history");
+        }
+        flock(history_fd, LOCK_UN);
+    }
+    free(buf);
+}
+
+// An entry as read back from a line of the history file
+static char *decode_history_line(const char *line, size_t len) {
+    char *entry = malloc(len + 1);
+    if (!entry) return NULL;
+    
+    size_t out = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (line[i] == '\\' && i + 1 < len) {
+            i++;
+            entry[out++] = line[i] == 'n' ? '\n' : line[i];
+        } else {
+            entry[out++] = line[i];
+        }
+    }
+    entry[out] = '\0';
+    return entry;
+}
+
 void add_to_history(char *line) {
-    if (history_count >= MAX_HISTORY) {
-        // Remove oldest entry
-        free(history[0]);
-        for (int i = 0; i < MAX_HISTORY - 1; i++) {
-            history[i] = history[i + 1];
+    history_push(strdup(line));
+    
+    if (history_fd != -1 && history.capacity > 0) {
+        append_history_line(line);
+    }
+}
+
+// Look up an entry by its history number
+char *history_get(long number) {
+    if (number < history.base || number >= history.base + history.count) {
+        return NULL;
+    }
+    long offset = number - history.base;
+    return history.entries[(history.start + offset) % history.capacity];
+}
+
+// Resize the ring, keeping the newest entries that still fit
+void history_set_size(int size) {
+    if (size < 0) size = 0;
+    if (history.entries && size == history.capacity) return;
+    
+    char **entries = malloc((size > 0 ? size : 1) * sizeof(char*));
+    if (!entries) {
+        perror("malloc");
+        return;
+    }
+    
+    int keep = history.count < size ? history.count : size;
+    int drop = history.count - keep;
+    for (int i = 0; i < history.count; i++) {
+        char *entry = history.entries[(history.start + i) % history.capacity];
+        if (i < drop) {
+            free(entry);
+        } else {
+            entries[i - drop] = entry;
         }
-        history_count--;
     }
     
-    history[history_count++] = strdup(line);
+    free(history.entries);
+    history.entries = entries;
+    history.capacity = size;
+    history.start = 0;
+    history.count = keep;
+    history.base += drop;
 }
 
-void save_history(void) {
+void free_history(void) {
+    history_index_clear();
+    for (int i = 0; i < history.count; i++) {
+        free(history.entries[(history.start + i) % history.capacity]);
+    }
+    free(history.entries);
+    history.entries = NULL;
+    history.capacity = 0;
+    history.start = 0;
+    history.count = 0;
+}
+
+static int history_file_path(char *buf, size_t size) {
     char *home = get_shell_var("HOME");
     if (!home) home = getenv("HOME");
-    if (!home) return;
+    if (!home) return 0;
     
-    char history_file[1024];
-    snprintf(history_file, sizeof(history_file), "%s/.shell_history", home);
+    snprintf(buf, size, "%s/.shell_history", home);
+    return 1;
+}
+
+// Offset at which the last `lines` lines of buf begin
+static size_t tail_offset(const char *buf, size_t size, int lines) {
+    if (lines <= 0) return size;
     
-    FILE *file = fopen(history_file, "w");
-    if (!file) return;
+    size_t pos = size;
+    if (pos > 0 && buf[pos - 1] == '\n') pos--;
     
-    for (int i = 0; i < history_count; i++) {
-        fprintf(file, "%s\n", history[i]);
+    for (int i = 0; i < lines; i++) {
+        const char *newline = memrchr(buf, '\n', pos);
+        if (!newline) return 0;
+        pos = newline - buf;
+    }
+    return pos + 1;
+}
+
+// Write the last part of the history file, from start, to a new file in
+// the same directory and rename it over the old one. Until the rename the
+// old file is untouched, so a crash or a full disk can't lose it.
+static void replace_history_file(const char *map, size_t start, size_t size) {
+    char temp[sizeof(history_path) + 8];
+    snprintf(temp, sizeof(temp), "%s.XXXXXX", history_path);
+    int fd = mkstemp(temp);
+    if (fd == -1) {
+        perror("history");
+        return;
     }
     
-    fclose(file);
+    const char *data = map + start;
+    size_t left = size - start;
+    while (left > 0) {
+        ssize_t written = write(fd, data, left);
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) break;
+        data += written;
+        left -= written;
+    }
+    
+    if (left > 0 || fsync(fd) == -1 || rename(temp, history_path) == -1) {
+        perror("history");
+        unlink(temp);
+    }
+    close(fd);
 }
 
+// Every entry already reached the file as it was added, so all that is
+// left at exit is trimming it to HISTFILESIZE lines. That happens under an
+// exclusive lock, so shells exiting together each trim the merged file
+// instead of overwriting one another's history.
+void save_history(void) {
+    if (history_fd == -1) return;
+    
+    char *filesize = get_shell_var("HISTFILESIZE");
+    int limit = filesize ? atoi(filesize) : history.capacity;
+    
+    if (limit > 0 && lock_history(LOCK_EX) == 0) {
+        struct stat st;
+        if (fstat(history_fd, &st) == 0 && st.st_size > 0) {
+            size_t size = st.st_size;
+            char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, history_fd, 0);
+            if (map != MAP_FAILED) {
+                size_t start = tail_offset(map, size, limit);
+                if (start > 0) {
+                    replace_history_file(map, start, size);
+                }
+                munmap(map, size);
+            }
+        }
+        flock(history_fd, LOCK_UN);
+    }
+    
+    close(history_fd);
+    history_fd = -1;
+}
+
+// Map the history file and index only its last HISTSIZE lines, scanning
+// backwards from the end rather than reading the whole file.
 void load_history(void) {
-    char *home = get_shell_var("HOME");
-    if (!home) home = getenv("HOME");
-    if (!home) return;
+    if (!history_file_path(history_path, sizeof(history_path))) return;
     
-    char history_file[1024];
-    snprintf(history_file, sizeof(history_file), "%s/.shell_history", home);
+    history_fd = open(history_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (history_fd == -1) return;
     
-    FILE *file = fopen(history_file, "r");
-    if (!file) return;
+    if (!history.entries) {
+        history_set_size(DEFAULT_HISTSIZE);
+    }
     
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
+    if (lock_history(LOCK_SH) == -1) return;
     
-    while ((read = getline(&line, &len, file)) != -1 && history_count < MAX_HISTORY) {
-        // Remove newline
-        if (line[read-1] == '\n') {
-            line[read-1] = '\0';
-        }
-        
-        if (strlen(line) > 0) {
-            history[history_count++] = strdup(line);
+    struct stat st;
+    if (fstat(history_fd, &st) == 0 && st.st_size > 0) {
+        size_t size = st.st_size;
+        char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, history_fd, 0);
+        if (map != MAP_FAILED) {
+            size_t pos = tail_offset(map, size, history.capacity);
+            while (pos < size) {
+                char *newline = memchr(map + pos, '\n', size - pos);
+                size_t end = newline ? (size_t)(newline - map) : size;
+                if (end > pos) {
+                    char *entry = decode_history_line(map + pos, end - pos);
+                    if (entry) history_push(entry);
+                }
+                pos = end + 1;
+            }
+            munmap(map, size);
         }
     }
     
-    free(line);
-    fclose(file);
+    flock(history_fd, LOCK_UN);
 }
 
 // Alias functions
 void add_alias(char *name, char *value) {
-    // Check if alias already exists
-    for (int i = 0; i < alias_count; i++) {
-        if (strcmp(aliases[i].name, name) == 0) {
-            free(aliases[i].value);
-            aliases[i].value = strdup(value);
-            return;
-        }
-    }
-    
-    // Add new alias
-    if (alias_count < MAX_ALIASES) {
-        aliases[alias_count].name = strdup(name);
-        aliases[alias_count].value = strdup(value);
-        alias_count++;
-    }
+    free(hash_table_put(&alias_table, name, strdup(value)));
 }
 
 char *get_alias(char *name) {
-    for (int i = 0; i < alias_count; i++) {
-        if (strcmp(aliases[i].name, name) == 0) {
-            return aliases[i].value;
-        }
-    }
-    return NULL;
+    return hash_table_get(&alias_table, name);
 }
 
 void remove_alias(char *name) {
-    for (int i = 0; i < alias_count; i++) {
-        if (strcmp(aliases[i].name, name) == 0) {
-            free(aliases[i].name);
-            free(aliases[i].value);
-            
-            // Shift remaining aliases
-            for (int j = i; j < alias_count - 1; j++) {
-                aliases[j] = aliases[j + 1];
-            }
-            alias_count--;
-            return;
-        }
-    }
+    free(hash_table_remove(&alias_table, name));
 }
 
 // Variable functions
-void set_shell_var(char *name, char *value) {
-    // Check if variable already exists
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(shell_vars[i].name, name) == 0) {
-            free(shell_vars[i].value);
-            shell_vars[i].value = strdup(value);
-            return;
+//
+// Shell variables and the environment are one store. Each variable is
+// kept as a single "NAME=value" string; an exported one also has a slot
+// in env_entries, the envp handed to every process we start. Assigning an
+// exported variable swaps its slot, unsetting it moves the last slot into
+// the hole, so the array is never rebuilt and never copied by libc.
+// environ points at it too, so getenv sees the same values.
+
+typedef struct shell_var {
+    char *entry;            // "NAME=value"
+    size_t name_len;
+    size_t capacity;        // bytes allocated for entry
+    int env_index;          // slot in env_entries, or -1 if not exported
+} shell_var_t;
+
+static char **env_entries = NULL;
+static int env_count = 0;
+static int env_capacity = 0;
+
+// Apply side effects of assigning variables the shell itself consumes
+static void shell_var_changed(char *name, char *value) {
+    if (strcmp(name, "HISTSIZE") == 0) {
+        history_set_size(value ? atoi(value) : DEFAULT_HISTSIZE);
+    } else if (strcmp(name, "PS1") == 0) {
+        prompt_invalidate();
+    }
+}
+
+static void env_add(shell_var_t *var) {
+    if (env_count + 1 >= env_capacity) {
+        int capacity = env_capacity ? env_capacity * 2 : 64;
+        char **entries = realloc(env_entries, capacity * sizeof(char*));
+        if (!entries) {
+            fprintf(stderr, "allocation error\n");
+            exit(EXIT_FAILURE);
         }
+        env_entries = entries;
+        env_capacity = capacity;
+        environ = env_entries;
     }
-    
-    // Add new variable
-    if (var_count < MAX_VARS) {
-        shell_vars[var_count].name = strdup(name);
-        shell_vars[var_count].value = strdup(value);
-        var_count++;
+    var->env_index = env_count;
+    env_entries[env_count++] = var->entry;
+    env_entries[env_count] = NULL;
+}
+
+static void env_remove(shell_var_t *var) {
+    int last = --env_count;
+    if (var->env_index != last) {
+        // Move the last entry into the hole and tell its variable
+        char *moved = env_entries[last];
+        char name[256];
+        size_t len = strcspn(moved, "=");
+        char *key = len < sizeof(name) ? name : malloc(len + 1);
+        memcpy(key, moved, len);
+        key[len] = '\0';
+        shell_var_t *other = hash_table_get(&var_table, key);
+        if (key != name) free(key);
+
+        env_entries[var->env_index] = moved;
+        other->env_index = var->env_index;
     }
+    env_entries[env_count] = NULL;
+    var->env_index = -1;
 }
 
-char *get_shell_var(char *name) {
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(shell_vars[i].name, name) == 0) {
-            return shell_vars[i].value;
+static void free_shell_var(void *value) {
+    shell_var_t *var = value;
+    free(var->entry);
+    free(var);
+}
+
+// Assign, keeping the variable's exported state; export forces it on. A
+// new value that fits where the old one was is written in place, so a
+// counter updated in a loop costs no allocation, and an exported
+// variable's envp slot keeps pointing at the right string.
+static shell_var_t *assign_var(char *name, char *value, int export) {
+    size_t value_len = strlen(value);
+    shell_var_t *var = hash_table_get(&var_table, name);
+
+    if (var && var->name_len + value_len + 2 <= var->capacity) {
+        memmove(var->entry + var->name_len + 1, value, value_len + 1);
+    } else {
+        size_t name_len = strlen(name);
+        size_t capacity = name_len + value_len + 2;
+        char *entry = malloc(capacity);
+        memcpy(entry, name, name_len);
+        entry[name_len] = '=';
+        memcpy(entry + name_len + 1, value, value_len + 1);
+
+        if (var) {
+            if (var->env_index >= 0) env_entries[var->env_index] = entry;
+            free(var->entry);
+        } else {
+            var = malloc(sizeof(shell_var_t));
+            var->name_len = name_len;
+            var->env_index = -1;
+            hash_table_put(&var_table, name, var);
         }
+        var->entry = entry;
+        var->capacity = capacity;
     }
-    return NULL;
+    if (export && var->env_index < 0) env_add(var);
+
+    shell_var_changed(name, var->entry + var->name_len + 1);
+    return var;
 }
 
-void unset_shell_var(char *name) {
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(shell_vars[i].name, name) == 0) {
-            free(shell_vars[i].name);
-            free(shell_vars[i].value);
-            
-            // Shift remaining variables
-            for (int j = i; j < var_count - 1; j++) {
-                shell_vars[j] = shell_vars[j + 1];
-            }
-            var_count--;
-            return;
-        }
+void set_shell_var(char *name, char *value) {
+    assign_var(name, value, 0);
+}
+
+// Set and export; a NULL value exports the variable as it stands
+void export_shell_var(char *name, char *value) {
+    if (value) {
+        assign_var(name, value, 1);
+        return;
     }
+    shell_var_t *var = hash_table_get(&var_table, name);
+    if (var && var->env_index < 0) env_add(var);
+}
+
+char *get_shell_var(char *name) {
+    shell_var_t *var = hash_table_get(&var_table, name);
+    return var ? var->entry + var->name_len + 1 : NULL;
+}
+
+void unset_shell_var(char *name) {
+    shell_var_t *var = hash_table_remove(&var_table, name);
+    if (!var) return;
+    if (var->env_index >= 0) env_remove(var);
+    free_shell_var(var);
+    shell_var_changed(name, NULL);
+}
+
+// The environment for new processes: every exported variable
+char **shell_envp(void) {
+    static char *empty[] = { NULL };
+    return env_entries ? env_entries : empty;
+}
+
+void free_shell_vars(void) {
+    static char *empty[] = { NULL };
+    environ = empty;
+    hash_table_clear(&var_table, free_shell_var);
+    free(env_entries);
+    env_entries = NULL;
+    env_count = env_capacity = 0;
 }
@@ -0,0 +1,144 @@
+#include "shell.h"
+
+// Substring index over the history, for incremental search.
+//
+// Every entry is broken into its trigrams (each run of three bytes), and
+// each trigram keeps a posting list: the numbers of the entries containing
+// it, oldest first. A query of three bytes or more only has to look at the
+// entries in the shortest posting list among its trigrams, newest first,
+// and confirm each with strstr. Entries falling out of the ring leave
+// stale numbers at the front of their lists; those are dropped whenever a
+// list is touched, and by a sweep of the whole index each time another
+// ring's worth of entries has gone by.
+//
+// Queries of one or two bytes match nearly everything, so they are
+// answered by scanning back from the newest entry, which stops almost
+// immediately.
+
+#define HISTORY_SWEEP_MIN 1024
+
+typedef struct posting_list {
+    long *numbers;
+    size_t start;           // numbers before this are stale
+    size_t count;           // including the stale ones
+    size_t capacity;
+} posting_list_t;
+
+static hash_table_t trigrams;
+static long added_since_sweep = 0;
+
+static void free_posting_list(void *value) {
+    posting_list_t *list = value;
+    free(list->numbers);
+    free(list);
+}
+
+// Drop the numbers of entries that are no longer in the ring
+static void trim_posting_list(posting_list_t *list) {
+    while (list->start < list->count && list->numbers[list->start] < history.base) {
+        list->start++;
+    }
+    if (list->start > list->count / 2) {
+        list->count -= list->start;
+        memmove(list->numbers, list->numbers + list->start, list->count * sizeof(long));
+        list->start = 0;
+    }
+}
+
+static void sweep_index(void) {
+    size_t pos = 0;
+    const char *key;
+    void *value;
+    while (hash_table_next(&trigrams, &pos, &key, &value)) {
+        posting_list_t *list = value;
+        trim_posting_list(list);
+        if (list->start == list->count) {
+            char gram[4];
+            memcpy(gram, key, sizeof(gram));
+            free_posting_list(hash_table_remove(&trigrams, gram));
+        }
+    }
+    added_since_sweep = 0;
+}
+
+void history_index_add(long number, const char *entry) {
+    size_t len = strlen(entry);
+    char gram[4] = { 0 };
+
+    for (size_t i = 0; i + 3 <= len; i++) {
+        memcpy(gram, entry + i, 3);
+        posting_list_t *list = hash_table_get(&trigrams, gram);
+        if (!list) {
+            list = calloc(1, sizeof(posting_list_t));
+            if (!list) return;
+            hash_table_put(&trigrams, gram, list);
+        }
+        // A trigram that repeats within the entry is listed once
+        if (list->count > list->start && list->numbers[list->count - 1] == number) {
+            continue;
+        }
+
+        trim_posting_list(list);
+        if (list->count == list->capacity) {
+            size_t capacity = list->capacity ? list->capacity * 2 : 4;
+            long *numbers = realloc(list->numbers, capacity * sizeof(long));
+            if (!numbers) return;
+            list->numbers = numbers;
+            list->capacity = capacity;
+        }
+        list->numbers[list->count++] = number;
+    }
+
+    long sweep_every = history.capacity > HISTORY_SWEEP_MIN ? history.capacity : HISTORY_SWEEP_MIN;
+    if (++added_since_sweep >= sweep_every) {
+        sweep_index();
+    }
+}
+
+void history_index_clear(void) {
+    hash_table_clear(&trigrams, free_posting_list);
+    added_since_sweep = 0;
+}
+
+// Newest entry numbered below `before` that contains query, or 0
+long history_search(const char *query, long before) {
+    size_t len = strlen(query);
+    long newest = history.base + history.count;
+    if (before > newest) before = newest;
+
+    if (len < 3) {
+        for (long number = before - 1; number >= history.base; number--) {
+            if (strstr(history_get(number), query)) return number;
+        }
+        return 0;
+    }
+
+    // The rarest trigram of the query narrows the candidates the most
+    posting_list_t *rarest = NULL;
+    char gram[4] = { 0 };
+    for (size_t i = 0; i + 3 <= len; i++) {
+        memcpy(gram, query + i, 3);
+        posting_list_t *list = hash_table_get(&trigrams, gram);
+        if (!list) return 0;
+        trim_posting_list(list);
+        if (!rarest || list->count - list->start < rarest->count - rarest->start) {
+            rarest = list;
+        }
+    }
+
+    // Binary search for the first number at or past `before`, then walk back
+    size_t lo = rarest->start, hi = rarest->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (rarest->numbers[mid] < before) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    while (lo > rarest->start) {
+        long number = rarest->numbers[--lo];
+        if (strstr(history_get(number), query)) return number;
+    }
+    return 0;
+}
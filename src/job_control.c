@@ -1,100 +1,500 @@
 #include "shell.h"
 
+// Jobs. A job is every process started for one pipeline (or one simple
+// command), and when the shell is interactive they all share a process
+// group: the terminal is handed to that group while it runs in the
+// foreground, Ctrl-Z stops the whole group, and fg/bg/kill signal the group
+// rather than a single pid.
+//
+// The SIGCHLD handler only writes a byte to a self-pipe; the main loop polls
+// that pipe together with stdin and reaps whatever changed state as soon as
+// it wakes, so finished background jobs never linger as zombies. Jobs are
+// indexed by member pid and by job number, and state changes of background
+// jobs are queued for the report printed before the next prompt.
+
 static int next_job_id = 1;
+static int listed_jobs = 0;
+static job_t *job_tail = NULL;
+static hash_table_t jobs_by_pid;
+static job_t **jobs_by_id = NULL;
+static int jobs_by_id_capacity = 0;
 
-void add_job(pid_t pid, char *command) {
-    job_t *new_job = malloc(sizeof(job_t));
-    if (!new_job) {
-        perror("malloc");
+// Numbers of background jobs that finished or stopped since the last report
+static int *notify_ids = NULL;
+static int notify_count = 0;
+static int notify_capacity = 0;
+
+static int sigchld_pipe[2] = { -1, -1 };
+
+static pid_t shell_pgid = 0;
+static struct termios shell_tmodes;
+
+static void pid_key(pid_t pid, char *key, size_t size) {
+    snprintf(key, size, "%ld", (long)pid);
+}
+
+static void sigchld_handler(int sig) {
+    int saved_errno = errno;
+    (void)sig;
+    if (write(sigchld_pipe[1], "", 1) == -1) {
+        // Pipe full: a wakeup is already pending
+    }
+    errno = saved_errno;
+}
+
+void init_job_control(void) {
+    if (pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        perror("pipe");
         return;
     }
-    
-    new_job->id = next_job_id++;
-    new_job->pid = pid;
-    new_job->command = strdup(command);
-    new_job->status = JOB_RUNNING;
-    new_job->next = job_list;
-    
-    job_list = new_job;
-}
-
-void remove_job(pid_t pid) {
-    job_t **current = &job_list;
-    
-    while (*current) {
-        if ((*current)->pid == pid) {
-            job_t *to_remove = *current;
-            *current = (*current)->next;
-            
-            free(to_remove->command);
-            free(to_remove);
-            return;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchld_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+// Put the shell in its own process group in the foreground of the
+// controlling terminal. Only done for interactive sessions.
+void enable_job_control(void) {
+    if (!isatty(STDIN_FILENO)) return;
+
+    // If we were started in the background, wait until we are brought forward
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp())) {
+        kill(-shell_pgid, SIGTTIN);
+    }
+
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    // Fails harmlessly for a session leader, which already leads its group
+    setpgid(0, 0);
+    shell_pgid = getpgrp();
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    tcgetattr(STDIN_FILENO, &shell_tmodes);
+
+    job_control = 1;
+}
+
+int job_event_fd(void) {
+    return sigchld_pipe[0];
+}
+
+job_t *create_job(const char *command, int foreground) {
+    job_t *job = calloc(1, sizeof(job_t));
+    if (!job) {
+        perror("malloc");
+        return NULL;
+    }
+
+    job->command = strdup(command);
+    job->status = JOB_RUNNING;
+    job->foreground = foreground;
+    job->timing = current_timing();
+    return job;
+}
+
+// Record a process that was started for the job. The first one founds the
+// process group. The child joins the group itself as well; doing it here
+// too means it is in place whichever side runs first.
+void job_add_process(job_t *job, pid_t pid) {
+    job->procs = realloc(job->procs, (job->nprocs + 1) * sizeof(job_process_t));
+    job->procs[job->nprocs].pid = pid;
+    job->procs[job->nprocs].status = JOB_RUNNING;
+    job->procs[job->nprocs].exit_status = 0;
+    job->nprocs++;
+    job->status = JOB_RUNNING;
+
+    int founder = !job->pgid;
+    if (founder) {
+        job->pgid = pid;
+    }
+    if (job_control) {
+        setpgid(pid, job->pgid);
+        if (job->foreground && founder) {
+            tcsetpgrp(STDIN_FILENO, job->pgid);
         }
-        current = &((*current)->next);
     }
+
+    char key[24];
+    pid_key(pid, key, sizeof(key));
+    hash_table_put(&jobs_by_pid, key, job);
 }
 
-void update_job_status(void) {
-    job_t *current = job_list;
-    
-    while (current) {
+// Enter the job in the job table, keeping the list in job-number order
+static void list_job(job_t *job) {
+    job->id = next_job_id++;
+    job->next = NULL;
+    job->prev = job_tail;
+    if (job_tail) {
+        job_tail->next = job;
+    } else {
+        job_list = job;
+    }
+    job_tail = job;
+    listed_jobs++;
+
+    if (job->id >= jobs_by_id_capacity) {
+        int capacity = jobs_by_id_capacity ? jobs_by_id_capacity * 2 : 16;
+        while (capacity <= job->id) capacity *= 2;
+        jobs_by_id = realloc(jobs_by_id, capacity * sizeof(job_t*));
+        memset(jobs_by_id + jobs_by_id_capacity, 0,
+               (capacity - jobs_by_id_capacity) * sizeof(job_t*));
+        jobs_by_id_capacity = capacity;
+    }
+    jobs_by_id[job->id] = job;
+}
+
+// Number of jobs in the job table
+int job_count(void) {
+    return listed_jobs;
+}
+
+// Forget a job: take it out of the job table (if it is there) and the pid
+// index, and free it
+void release_job(job_t *job) {
+    if (job->id) {
+        if (job->prev) {
+            job->prev->next = job->next;
+        } else {
+            job_list = job->next;
+        }
+        if (job->next) {
+            job->next->prev = job->prev;
+        } else {
+            job_tail = job->prev;
+        }
+        jobs_by_id[job->id] = NULL;
+        listed_jobs--;
+
+        // Start numbering again once nothing is left
+        if (!job_list) next_job_id = 1;
+    }
+
+    for (int i = 0; i < job->nprocs; i++) {
+        char key[24];
+        pid_key(job->procs[i].pid, key, sizeof(key));
+        hash_table_remove(&jobs_by_pid, key);
+    }
+
+    free(job->procs);
+    free(job->command);
+    free(job);
+}
+
+static void queue_notification(job_t *job) {
+    if (notify_count == notify_capacity) {
+        notify_capacity = notify_capacity ? notify_capacity * 2 : 16;
+        notify_ids = realloc(notify_ids, notify_capacity * sizeof(int));
+    }
+    notify_ids[notify_count++] = job->id;
+}
+
+// A job is done when every process is, stopped when every live process is
+static job_status_t job_state(const job_t *job) {
+    int stopped = 0;
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].status == JOB_RUNNING) return JOB_RUNNING;
+        if (job->procs[i].status == JOB_STOPPED) stopped = 1;
+    }
+    return stopped ? JOB_STOPPED : JOB_DONE;
+}
+
+// Apply a wait status to the process it belongs to
+static void record_status(pid_t pid, int status, const struct rusage *usage) {
+    job_t *job = find_job_by_pid(pid);
+    if (!job) return;
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        account_child_usage(job->timing, usage);
+    }
+
+    job_process_t *proc = NULL;
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].pid == pid) {
+            proc = &job->procs[i];
+            break;
+        }
+    }
+
+    if (WIFSTOPPED(status)) {
+        proc->status = JOB_STOPPED;
+    } else if (WIFCONTINUED(status)) {
+        proc->status = JOB_RUNNING;
+    } else {
+        proc->status = JOB_DONE;
+        proc->exit_status = WIFEXITED(status) ? WEXITSTATUS(status)
+                                              : 128 + WTERMSIG(status);
+    }
+
+    job_status_t old = job->status;
+    job->status = job_state(job);
+    if (!job->foreground && job->id && job->status != old &&
+        job->status != JOB_RUNNING) {
+        queue_notification(job);
+    }
+}
+
+// Wait until a foreground job finishes or stops, then take the terminal
+// back. A finished job is released; a stopped one stays in the job table.
+// Returns the job's status for $?: the last process's, 127 if nothing
+// could be started, or 128+SIGTSTP when the job was stopped.
+int wait_for_job(job_t *job) {
+    if (job->nprocs == 0) {
+        release_job(job);
+        return 127;
+    }
+
+    while (job->status == JOB_RUNNING) {
+        pid_t target = job->pgid;
+        if (job_control) {
+            target = -job->pgid;
+        } else {
+            for (int i = 0; i < job->nprocs; i++) {
+                if (job->procs[i].status == JOB_RUNNING) {
+                    target = job->procs[i].pid;
+                    break;
+                }
+            }
+        }
+
         int status;
-        pid_t result = waitpid(current->pid, &status, WNOHANG | WUNTRACED);
-        
-        if (result > 0) {
-            if (WIFEXITED(status) || WIFSIGNALED(status)) {
-                current->status = JOB_DONE;
-            } else if (WIFSTOPPED(status)) {
-                current->status = JOB_STOPPED;
+        struct rusage usage;
+        pid_t pid = wait4(target, &status, job_control ? WUNTRACED : 0, &usage);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            // Somebody else reaped them; nothing left to wait for
+            for (int i = 0; i < job->nprocs; i++) {
+                if (job->procs[i].status == JOB_RUNNING) {
+                    job->procs[i].status = JOB_DONE;
+                }
             }
-        } else if (result == -1) {
-            // Process doesn't exist anymore
-            current->status = JOB_DONE;
+            job->status = job_state(job);
+            break;
         }
-        
-        current = current->next;
-    }
-    
-    // Remove completed jobs
-    job_t **current_ptr = &job_list;
-    while (*current_ptr) {
-        if ((*current_ptr)->status == JOB_DONE) {
-            job_t *to_remove = *current_ptr;
-            *current_ptr = (*current_ptr)->next;
-            
-            printf("[%d]+ Done                    %s\n", 
-                   to_remove->id, to_remove->command);
-            
-            free(to_remove->command);
-            free(to_remove);
-        } else {
-            current_ptr = &((*current_ptr)->next);
+        record_status(pid, status, &usage);
+    }
+
+    if (job_control) {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+    }
+    job->foreground = 0;
+
+    if (job->status == JOB_STOPPED) {
+        if (!job->id) list_job(job);
+        printf("\n[%d]+ Stopped                 %s\n", job->id, job->command);
+        return 128 + SIGTSTP;
+    }
+
+    int status = job->procs[job->nprocs - 1].exit_status;
+    if (job_control && status == 128 + SIGINT) {
+        putchar('\n');  // keep the prompt off the ^C line
+    }
+    release_job(job);
+    return status;
+}
+
+// Drop an exited process from a job. When the last one goes, its process
+// group is gone too: the terminal comes back to the shell and the next
+// process added founds a new group.
+static void remove_process(job_t *job, int index) {
+    char key[24];
+    pid_key(job->procs[index].pid, key, sizeof(key));
+    hash_table_remove(&jobs_by_pid, key);
+
+    job->procs[index] = job->procs[--job->nprocs];
+    if (job->nprocs == 0) {
+        if (job_control && job->foreground) {
+            tcsetpgrp(STDIN_FILENO, shell_pgid);
+            tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
         }
+        job->pgid = 0;
     }
 }
 
-job_t *find_job(int id) {
-    job_t *current = job_list;
-    
-    while (current) {
-        if (current->id == id) {
-            return current;
+// Wait for the next process of a foreground job to exit, drop it from the
+// job and return its pid, with its status in *exit_status. Returns -1 once
+// the job has no processes left. This is for jobs that keep adding
+// processes (the parallel builtin), which can't be suspended half-way: if
+// Ctrl-Z stops the job it is simply continued.
+pid_t wait_for_job_process(job_t *job, int *exit_status) {
+    while (job->nprocs > 0) {
+        int status;
+        struct rusage usage;
+        pid_t pid = wait4(job_control ? -job->pgid : -1, &status,
+                          job_control ? WUNTRACED : 0, &usage);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            // Nothing left to wait for
+            while (job->nprocs > 0) remove_process(job, 0);
+            return -1;
+        }
+        record_status(pid, status, &usage);
+
+        if (job->status == JOB_STOPPED) {
+            for (int i = 0; i < job->nprocs; i++) {
+                if (job->procs[i].status == JOB_STOPPED) {
+                    job->procs[i].status = JOB_RUNNING;
+                }
+            }
+            job->status = job_state(job);
+            signal_job(job, SIGCONT);
+            continue;
+        }
+
+        for (int i = 0; i < job->nprocs; i++) {
+            if (job->procs[i].pid == pid && job->procs[i].status == JOB_DONE) {
+                *exit_status = job->procs[i].exit_status;
+                remove_process(job, i);
+                return pid;
+            }
         }
-        current = current->next;
     }
-    
-    return NULL;
+    return -1;
 }
 
-job_t *find_job_by_pid(pid_t pid) {
-    job_t *current = job_list;
-    
-    while (current) {
-        if (current->pid == pid) {
-            return current;
+// Leave a freshly started job running and report it
+void background_job(job_t *job) {
+    if (job->nprocs == 0) {
+        release_job(job);
+        return;
+    }
+
+    list_job(job);
+    last_background_pid = job->procs[job->nprocs - 1].pid;
+    if (job_control) {
+        printf("[%d] %d\n", job->id, last_background_pid);
+    }
+}
+
+// Start a single process as a foreground job and wait for it
+int run_in_foreground(spawn_req_t *req, const char *command) {
+    job_t *job = create_job(command, 1);
+    if (!job) return 1;
+
+    req->job = job;
+    spawn_process(req);
+    return wait_for_job(job);
+}
+
+int signal_job(job_t *job, int sig) {
+    if (job_control) {
+        return kill(-job->pgid, sig);
+    }
+
+    int result = -1;
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].status != JOB_DONE && kill(job->procs[i].pid, sig) == 0) {
+            result = 0;
         }
-        current = current->next;
     }
-    
-    return NULL;
+    return result;
+}
+
+// Resume a job, in the foreground (waiting for it, returning its status)
+// or in the background (returning 0). Returns 1 if it can't be signalled.
+int continue_job(job_t *job, int foreground) {
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].status == JOB_STOPPED) {
+            job->procs[i].status = JOB_RUNNING;
+        }
+    }
+    job->status = job_state(job);
+    job->foreground = foreground;
+
+    if (foreground && job_control) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    }
+    if (job->status == JOB_RUNNING && signal_job(job, SIGCONT) == -1) {
+        perror("kill");
+        job->foreground = 0;
+        if (foreground && job_control) {
+            tcsetpgrp(STDIN_FILENO, shell_pgid);
+        }
+        return 1;
+    }
+
+    return foreground ? wait_for_job(job) : 0;
+}
+
+// Collect every child that changed state. Only called when the shell has
+// no foreground job, so waitpid(-1) can't steal one of its processes.
+void reap_children(void) {
+    char buf[64];
+    while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0) {
+        // Drain wakeups
+    }
+
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+        record_status(pid, status, &usage);
+    }
+}
+
+// Reap, then report background jobs that finished or stopped since the last
+// call; finished ones are forgotten
+void update_job_status(void) {
+    reap_children();
+
+    for (int i = 0; i < notify_count; i++) {
+        job_t *job = find_job(notify_ids[i]);
+        if (!job) continue;
+
+        if (job->status == JOB_DONE) {
+            printf("[%d]+ Done                    %s\n", job->id, job->command);
+            release_job(job);
+        } else if (job->status == JOB_STOPPED) {
+            printf("[%d]+ Stopped                 %s\n", job->id, job->command);
+        }
+    }
+    notify_count = 0;
+}
+
+job_t *find_job(int id) {
+    if (id <= 0 || id >= jobs_by_id_capacity) {
+        return NULL;
+    }
+    return jobs_by_id[id];
+}
+
+job_t *find_job_by_pid(pid_t pid) {
+    char key[24];
+    pid_key(pid, key, sizeof(key));
+    return hash_table_get(&jobs_by_pid, key);
+}
+
+// Resolve a job argument: %n or n for job n, nothing, % or %+ for the most
+// recent job
+job_t *parse_job_spec(const char *spec) {
+    if (!spec || strcmp(spec, "%") == 0 || strcmp(spec, "%+") == 0) {
+        return job_tail;
+    }
+    if (spec[0] == '%') spec++;
+
+    char *end;
+    long id = strtol(spec, &end, 10);
+    if (end == spec || *end != '\0' || id <= 0 || id >= jobs_by_id_capacity) {
+        return NULL;
+    }
+    return jobs_by_id[id];
+}
+
+void free_jobs(void) {
+    while (job_list) {
+        release_job(job_list);
+    }
+    hash_table_clear(&jobs_by_pid, NULL);
+    free(jobs_by_id);
+    jobs_by_id = NULL;
+    jobs_by_id_capacity = 0;
+    free(notify_ids);
+    notify_ids = NULL;
+    notify_count = notify_capacity = 0;
 }
@@ -0,0 +1,742 @@
+#include "shell.h"
+#include <sys/ioctl.h>
+
+// Reading command lines.
+//
+// Input is read in blocks through our own buffer rather than stdio, so
+// that we know when it is empty and can sleep in poll() on stdin and the
+// SIGCHLD pipe together.
+//
+// On a terminal, lines are edited in raw mode:
+//   Left/Right, Ctrl-B/F   move a character    Home/End, Ctrl-A/E   ends
+//   Up/Down, Ctrl-P/N      history             Ctrl-R   search history
+//   Backspace, Del, Ctrl-D delete (Ctrl-D on an empty line is EOF)
+//   Ctrl-W   delete word   Ctrl-U/K   delete to start/end   Ctrl-L   clear
+//   Ctrl-C   abandon the line                  Tab      complete
+// Each keystroke redraws the line with a single write(). A line wider
+// than the terminal scrolls sideways to keep the cursor in view.
+//
+// Ctrl-R searches incrementally through the history index (see
+// history_index.c), newest match first; Ctrl-R again finds the next older
+// one. Enter runs the match, any editing key takes it into the line, and
+// Ctrl-G or Esc puts back what was there before.
+//
+// Tab completes the word before the cursor as a command name or a file
+// name (see completion.c), as far as the candidates agree; a second Tab
+// lists them.
+
+#define ESCAPE_TIMEOUT_MS 50
+#define SEARCH_QUERY_MAX 256
+#define COMPLETION_ASK_OVER 100
+
+#define CTRL_KEY(c) ((c) & 0x1f)
+
+// Keys that arrive as escape sequences
+enum {
+    KEY_LEFT = 1000,
+    KEY_RIGHT,
+    KEY_UP,
+    KEY_DOWN,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE,
+    KEY_ESCAPE,
+    KEY_NONE
+};
+
+static char input_buf[4096];
+static size_t input_pos = 0;
+static size_t input_len = 0;
+
+typedef struct line_state {
+    char *buf;
+    size_t len;
+    size_t capacity;
+    size_t pos;             // cursor, as a byte offset
+    const char *prompt;     // the whole prompt
+    const char *last_line;  // the part of it on the input line
+    int prompt_cols;
+    int cols;               // terminal width
+    long history_number;    // entry on show; one past the newest for the new line
+    char *saved;            // the new line, while browsing history
+} line_state_t;
+
+#define NEWLINE_MARK "\xe2\x8f\x8e"      // U+23CE, how a newline in the line is shown
+
+// Output is gathered here so each redraw is a single write
+typedef struct out_buf {
+    char *data;
+    size_t len;
+    size_t capacity;
+} out_buf_t;
+
+static void out_append(out_buf_t *out, const char *text, size_t len) {
+    if (out->len + len > out->capacity) {
+        size_t capacity = out->capacity ? out->capacity * 2 : 256;
+        while (capacity < out->len + len) capacity *= 2;
+        char *data = realloc(out->data, capacity);
+        if (!data) return;
+        out->data = data;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->len, text, len);
+    out->len += len;
+}
+
+static void out_puts(out_buf_t *out, const char *text) {
+    out_append(out, text, strlen(text));
+}
+
+// Line text, with each newline (from a command recalled from history that
+// was typed over several lines) shown as a one-column mark
+static void out_append_text(out_buf_t *out, const char *text, size_t len) {
+    const char *newline;
+    while ((newline = memchr(text, '\n', len))) {
+        out_append(out, text, newline - text);
+        out_puts(out, NEWLINE_MARK);
+        len -= newline - text + 1;
+        text = newline + 1;
+    }
+    out_append(out, text, len);
+}
+
+static void out_flush(out_buf_t *out) {
+    size_t done = 0;
+    while (done < out->len) {
+        ssize_t n = write(STDOUT_FILENO, out->data + done, out->len - done);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        done += n;
+    }
+    free(out->data);
+    out->data = NULL;
+    out->len = out->capacity = 0;
+}
+
+// Block until stdin is readable, reaping children whenever one exits
+static void wait_for_input(void) {
+    struct pollfd fds[2];
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = job_event_fd();
+    fds[1].events = POLLIN;
+    nfds_t nfds = fds[1].fd >= 0 ? 2 : 1;
+
+    for (;;) {
+        if (poll(fds, nfds, -1) == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        if (nfds > 1 && (fds[1].revents & POLLIN)) {
+            reap_children();
+        }
+        if (fds[0].revents) {
+            return;
+        }
+    }
+}
+
+// Refill the input buffer. Returns 0 at end of input.
+static int fill_input(void) {
+    for (;;) {
+        wait_for_input();
+        ssize_t n = read(STDIN_FILENO, input_buf, sizeof(input_buf));
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("readline");
+            exit(EXIT_FAILURE);
+        }
+        input_pos = 0;
+        input_len = n;
+        return n > 0;
+    }
+}
+
+// Is another byte already on its way? Used to tell Esc from the start of
+// an escape sequence.
+static int input_ready(int timeout_ms) {
+    if (input_pos < input_len) return 1;
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+static int next_byte(void) {
+    if (input_pos == input_len && !fill_input()) {
+        return -1;
+    }
+    return (unsigned char)input_buf[input_pos++];
+}
+
+// Read one key, decoding the escape sequences terminals send
+static int read_key(void) {
+    int c = next_byte();
+    if (c != 27) return c;
+
+    if (!input_ready(ESCAPE_TIMEOUT_MS)) return KEY_ESCAPE;
+    int kind = next_byte();
+    if (kind != '[' && kind != 'O') return KEY_NONE;
+
+    // CSI: parameters, then a final byte
+    int param = 0;
+    int c2;
+    while ((c2 = next_byte()) != -1 && ((c2 >= '0' && c2 <= '9') || c2 == ';')) {
+        if (c2 == ';') break;   // modifiers follow; only the first number matters
+        param = param * 10 + (c2 - '0');
+    }
+    while (c2 == ';' || (c2 >= '0' && c2 <= '9')) c2 = next_byte();
+
+    switch (c2) {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    case '~':
+        switch (param) {
+        case 1: case 7: return KEY_HOME;
+        case 4: case 8: return KEY_END;
+        case 3: return KEY_DELETE;
+        }
+        return KEY_NONE;
+    case -1:
+        return -1;
+    }
+    return KEY_NONE;
+}
+
+// Columns text takes on screen: escape sequences take none, and a UTF-8
+// character or a newline (see out_append_text) takes one
+static int display_width(const char *text, size_t len) {
+    int width = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = text[i];
+        if (c == 27 && i + 1 < len && text[i + 1] == '[') {
+            for (i += 2; i < len && !(text[i] >= 0x40 && text[i] <= 0x7e); i++);
+        } else if ((c & 0xc0) != 0x80 && (c >= ' ' || c == '\n')) {
+            width++;
+        }
+    }
+    return width;
+}
+
+static size_t prev_char(const line_state_t *ls, size_t pos) {
+    if (pos == 0) return 0;
+    do pos--; while (pos > 0 && (ls->buf[pos] & 0xc0) == 0x80);
+    return pos;
+}
+
+static size_t next_char(const line_state_t *ls, size_t pos) {
+    if (pos >= ls->len) return ls->len;
+    do pos++; while (pos < ls->len && (ls->buf[pos] & 0xc0) == 0x80);
+    return pos;
+}
+
+static int terminal_columns(void) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+        return 80;
+    }
+    return ws.ws_col;
+}
+
+// Redraw the input line: the last line of the prompt, then as much of the
+// buffer as fits, scrolled so the cursor is visible
+static void refresh_line(line_state_t *ls) {
+    int avail = ls->cols - ls->prompt_cols - 1;
+    if (avail < 1) avail = 1;
+
+    size_t from = 0;
+    int before_cursor = display_width(ls->buf, ls->pos);
+    while (before_cursor > avail) {
+        size_t next = next_char(ls, from);
+        before_cursor -= display_width(ls->buf + from, next - from);
+        from = next;
+    }
+    size_t to = ls->pos;
+    int shown = before_cursor;
+    while (to < ls->len) {
+        size_t next = next_char(ls, to);
+        int width = display_width(ls->buf + to, next - to);
+        if (shown + width > avail) break;
+        shown += width;
+        to = next;
+    }
+
+    out_buf_t out = { NULL, 0, 0 };
+    char move[32];
+    out_puts(&out, "\r");
+    out_puts(&out, ls->last_line);
+    out_append_text(&out, ls->buf + from, to - from);
+    out_puts(&out, "\033[K\r");
+    int column = ls->prompt_cols + before_cursor;
+    if (column > 0) {
+        snprintf(move, sizeof(move), "\033[%dC", column);
+        out_puts(&out, move);
+    }
+    out_flush(&out);
+}
+
+static void set_line(line_state_t *ls, const char *text) {
+    size_t len = strlen(text);
+    if (len + 1 > ls->capacity) {
+        char *buf = realloc(ls->buf, len + 1);
+        if (!buf) return;
+        ls->buf = buf;
+        ls->capacity = len + 1;
+    }
+    memcpy(ls->buf, text, len + 1);
+    ls->len = ls->pos = len;
+}
+
+static void insert_text(line_state_t *ls, const char *text, size_t len) {
+    if (ls->len + len + 1 > ls->capacity) {
+        size_t capacity = ls->capacity * 2;
+        while (capacity < ls->len + len + 1) capacity *= 2;
+        char *buf = realloc(ls->buf, capacity);
+        if (!buf) return;
+        ls->buf = buf;
+        ls->capacity = capacity;
+    }
+    memmove(ls->buf + ls->pos + len, ls->buf + ls->pos, ls->len - ls->pos + 1);
+    memcpy(ls->buf + ls->pos, text, len);
+    ls->len += len;
+    ls->pos += len;
+}
+
+static void delete_range(line_state_t *ls, size_t from, size_t to) {
+    memmove(ls->buf + from, ls->buf + to, ls->len - to + 1);
+    ls->len -= to - from;
+    ls->pos = from;
+}
+
+// Completion
+
+// Bytes that end a word; after the first four a command name is expected
+#define WORD_BREAKS "|;&( \t<>)"
+
+// The word the cursor is at the end of, with its quoting removed. Says
+// where it starts, whether it is in command position, and which quote (if
+// any) is still open at the cursor.
+static char *word_at_cursor(const line_state_t *ls, int *command_position, char *open_quote) {
+    int expect_command = 1;
+    int in_word = 0;
+    char quote = 0;
+    size_t start = ls->pos;
+
+    for (size_t i = 0; i < ls->pos; i++) {
+        char c = ls->buf[i];
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            } else if (c == '\\' && quote == '"') {
+                i++;
+            }
+            continue;
+        }
+
+        const char *brk = strchr(WORD_BREAKS, c);
+        if (c && brk) {
+            if (in_word) expect_command = 0;
+            in_word = 0;
+            if (brk - WORD_BREAKS < 4) expect_command = 1;
+            continue;
+        }
+        if (!in_word) {
+            in_word = 1;
+            start = i;
+            *command_position = expect_command;
+        }
+        if (c == '\\') {
+            i++;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        }
+    }
+    if (!in_word) *command_position = expect_command;
+    *open_quote = quote;
+
+    // Strip the quoting
+    char *word = malloc(ls->pos - start + 1);
+    size_t len = 0;
+    quote = 0;
+    for (size_t i = start; i < ls->pos; i++) {
+        char c = ls->buf[i];
+        if (quote ? c == quote : (c == '\'' || c == '"')) {
+            quote = quote ? 0 : c;
+        } else if (c == '\\' && quote != '\'' && i + 1 < ls->pos) {
+            word[len++] = ls->buf[++i];
+        } else {
+            word[len++] = c;
+        }
+    }
+    word[len] = '\0';
+    return word;
+}
+
+// Insert completed text, quoted to suit the quote open at the cursor
+static void insert_quoted(line_state_t *ls, const char *text, size_t len, char quote) {
+    const char *special = quote == '\'' ? "" : quote == '"' ? "\"\\$`" : " \t\\'\"|;&<>()$`*?[]";
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] && strchr(special, text[i])) insert_text(ls, "\\", 1);
+        insert_text(ls, text + i, 1);
+    }
+}
+
+static void bell(void) {
+    if (write(STDOUT_FILENO, "\a", 1) == -1) {
+        // Only a beep
+    }
+}
+
+// Show the candidates in columns under the line, then draw it again
+static void list_matches(line_state_t *ls, char **matches, int count) {
+    out_buf_t out = { NULL, 0, 0 };
+    out_puts(&out, "\r\n");
+
+    if (count > COMPLETION_ASK_OVER) {
+        char question[64];
+        snprintf(question, sizeof(question), "Display all %d possibilities? (y or n)", count);
+        out_puts(&out, question);
+        out_flush(&out);
+        int key = read_key();
+        out_puts(&out, "\r\n");
+        if (key != 'y' && key != 'Y') {
+            out_puts(&out, ls->prompt);
+            out_flush(&out);
+            return;
+        }
+    }
+
+    // Paths are shown by their last part
+    const char **shown = malloc(count * sizeof(char*));
+    int width = 0;
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(matches[i]);
+        const char *part = matches[i] + len;
+        if (part > matches[i] && part[-1] == '/') part--;
+        while (part > matches[i] && part[-1] != '/') part--;
+        shown[i] = part;
+        int w = display_width(part, strlen(part));
+        if (w > width) width = w;
+    }
+    width += 2;
+
+    int columns = ls->cols / width > 0 ? ls->cols / width : 1;
+    int rows = (count + columns - 1) / columns;
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < columns; c++) {
+            int i = c * rows + r;
+            if (i >= count) break;
+            out_puts(&out, shown[i]);
+            if ((c + 1) * rows + r < count) {
+                for (int pad = display_width(shown[i], strlen(shown[i])); pad < width; pad++) {
+                    out_append(&out, " ", 1);
+                }
+            }
+        }
+        out_puts(&out, "\r\n");
+    }
+    out_puts(&out, ls->prompt);
+    out_flush(&out);
+    free(shown);
+}
+
+// Tab: extend the word to the longest text all candidates share, or on a
+// second Tab with nothing to add, list them
+static void complete_line(line_state_t *ls, int again) {
+    int command_position = 0;
+    char quote = 0;
+    char *word = word_at_cursor(ls, &command_position, &quote);
+
+    int count;
+    char **matches = complete_word(word, command_position, &count);
+    if (!matches) {
+        bell();
+        free(word);
+        return;
+    }
+
+    size_t word_len = strlen(word);
+    size_t common = strlen(matches[0]);
+    for (int i = 1; i < count; i++) {
+        size_t n = 0;
+        while (n < common && matches[i][n] == matches[0][n]) n++;
+        common = n;
+    }
+
+    if (common > word_len) {
+        insert_quoted(ls, matches[0] + word_len, common - word_len, quote);
+    }
+    if (count == 1) {
+        if (matches[0][common - 1] != '/') {
+            if (quote) insert_text(ls, &quote, 1);
+            insert_text(ls, " ", 1);
+        }
+    } else if (common == word_len) {
+        if (again) {
+            list_matches(ls, matches, count);
+        } else {
+            bell();
+        }
+    }
+
+    for (int i = 0; i < count; i++) free(matches[i]);
+    free(matches);
+    free(word);
+}
+
+// Step through history; direction -1 is older
+static void browse_history(line_state_t *ls, int direction) {
+    long newest = history.base + history.count;
+    long number = ls->history_number + direction;
+    if (number < history.base || number > newest) return;
+
+    if (ls->history_number == newest) {
+        free(ls->saved);
+        ls->saved = strdup(ls->buf);
+    }
+    ls->history_number = number;
+    set_line(ls, number == newest ? (ls->saved ? ls->saved : "") : history_get(number));
+}
+
+static void show_search(line_state_t *ls, const char *query, long match) {
+    out_buf_t out = { NULL, 0, 0 };
+    out_puts(&out, "\r");
+    out_puts(&out, match || !*query ? "(reverse-i-search)`" : "(failing reverse-i-search)`");
+    out_puts(&out, query);
+    out_puts(&out, "': ");
+
+    // Keep it on one line
+    const char *text = match ? history_get(match) : ls->buf;
+    int room = ls->cols - 1 - display_width(out.data, out.len);
+    size_t len = 0;
+    while (text[len] && room > 0) {
+        if ((text[len] & 0xc0) != 0x80) room--;
+        len++;
+    }
+    while (text[len] && (text[len] & 0xc0) == 0x80) len++;
+    out_append_text(&out, text, len);
+    out_puts(&out, "\033[K");
+    out_flush(&out);
+}
+
+// Ctrl-R. Returns the key that ended the search for the editor to act
+// on, or KEY_NONE when there is nothing more to do.
+static int reverse_search(line_state_t *ls) {
+    char query[SEARCH_QUERY_MAX] = "";
+    size_t query_len = 0;
+    long newest = history.base + history.count;
+    long match = 0;
+
+    for (;;) {
+        show_search(ls, query, match);
+        int key = read_key();
+
+        if (key == CTRL_KEY('R')) {
+            long from = match ? match : newest;
+            long older = query_len ? history_search(query, from) : 0;
+            if (older) match = older;
+        } else if (key == 127 || key == CTRL_KEY('H')) {
+            if (query_len > 0) {
+                do query_len--; while (query_len > 0 && (query[query_len] & 0xc0) == 0x80);
+                query[query_len] = '\0';
+                match = query_len ? history_search(query, newest) : 0;
+            }
+        } else if (key >= ' ' && key < 256 && key != 127) {
+            if (query_len + 1 < sizeof(query)) {
+                query[query_len++] = key;
+                query[query_len] = '\0';
+                // The current match may still do
+                match = history_search(query, match ? match + 1 : newest);
+            }
+        } else if (key == CTRL_KEY('G') || key == KEY_ESCAPE) {
+            refresh_line(ls);
+            return KEY_NONE;
+        } else {
+            // Anything else takes the match into the line and goes on
+            if (match) {
+                set_line(ls, history_get(match));
+                ls->history_number = match;
+            }
+            refresh_line(ls);
+            return key;
+        }
+    }
+}
+
+static char *edit_line(const char *prompt, struct termios *cooked) {
+    line_state_t ls;
+    ls.capacity = 128;
+    ls.buf = malloc(ls.capacity);
+    if (!ls.buf) return NULL;
+    ls.buf[0] = '\0';
+    ls.len = ls.pos = 0;
+    ls.prompt = prompt;
+    ls.last_line = strrchr(prompt, '\n') ? strrchr(prompt, '\n') + 1 : prompt;
+    ls.prompt_cols = display_width(ls.last_line, strlen(ls.last_line));
+    ls.cols = terminal_columns();
+    ls.history_number = history.base + history.count;
+    ls.saved = NULL;
+    completion_prefetch();
+
+    struct termios raw = *cooked;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+    out_buf_t out = { NULL, 0, 0 };
+    out_puts(&out, prompt);
+    out_flush(&out);
+
+    char *result = NULL;
+    int interrupted = 0;
+    int last_key = 0;
+    for (;;) {
+        int key = read_key();
+        if (key == CTRL_KEY('R')) {
+            key = reverse_search(&ls);
+        }
+        int tabbed_again = key == '\t' && last_key == '\t';
+        last_key = key;
+
+        switch (key) {
+        case -1:
+            goto done;
+        case '\r':
+        case '\n':
+            ls.pos = ls.len;
+            refresh_line(&ls);
+            result = ls.buf;
+            ls.buf = NULL;
+            goto done;
+        case CTRL_KEY('C'):
+            interrupted = 1;
+            goto done;
+        case CTRL_KEY('D'):
+            if (ls.len == 0) goto done;
+            /* fall through */
+        case KEY_DELETE:
+            if (ls.pos < ls.len) delete_range(&ls, ls.pos, next_char(&ls, ls.pos));
+            break;
+        case 127:
+        case CTRL_KEY('H'):
+            if (ls.pos > 0) delete_range(&ls, prev_char(&ls, ls.pos), ls.pos);
+            break;
+        case KEY_LEFT:
+        case CTRL_KEY('B'):
+            ls.pos = prev_char(&ls, ls.pos);
+            break;
+        case KEY_RIGHT:
+        case CTRL_KEY('F'):
+            ls.pos = next_char(&ls, ls.pos);
+            break;
+        case KEY_HOME:
+        case CTRL_KEY('A'):
+            ls.pos = 0;
+            break;
+        case KEY_END:
+        case CTRL_KEY('E'):
+            ls.pos = ls.len;
+            break;
+        case KEY_UP:
+        case CTRL_KEY('P'):
+            browse_history(&ls, -1);
+            break;
+        case KEY_DOWN:
+        case CTRL_KEY('N'):
+            browse_history(&ls, 1);
+            break;
+        case CTRL_KEY('U'):
+            delete_range(&ls, 0, ls.pos);
+            break;
+        case CTRL_KEY('K'):
+            ls.buf[ls.pos] = '\0';
+            ls.len = ls.pos;
+            break;
+        case CTRL_KEY('W'): {
+            size_t start = ls.pos;
+            while (start > 0 && ls.buf[start - 1] == ' ') start--;
+            while (start > 0 && ls.buf[start - 1] != ' ') start--;
+            delete_range(&ls, start, ls.pos);
+            break;
+        }
+        case '\t':
+            complete_line(&ls, tabbed_again);
+            break;
+        case CTRL_KEY('L'):
+            out_puts(&out, "\033[H\033[2J");
+            out_puts(&out, prompt);
+            out_flush(&out);
+            break;
+        default:
+            if (key >= ' ' && key < 256 && key != 127) {
+                char c = key;
+                insert_text(&ls, &c, 1);
+            }
+            break;
+        }
+        refresh_line(&ls);
+    }
+
+done:
+    if (interrupted) {
+        out_puts(&out, "^C");
+    }
+    out_puts(&out, "\r\n");
+    out_flush(&out);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, cooked);
+    free(ls.buf);
+    free(ls.saved);
+    errno = interrupted ? EINTR : 0;
+    return result;
+}
+
+// Read a line without its newline, after showing prompt. Returns NULL at
+// end of input, or when the line was abandoned with Ctrl-C, in which case
+// errno is EINTR.
+char *read_line(const char *prompt) {
+    struct termios cooked;
+    if (job_control && isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &cooked) == 0) {
+        char *term = getenv("TERM");
+        if (!term || strcmp(term, "dumb") != 0) {
+            fflush(stdout);
+            return edit_line(prompt, &cooked);
+        }
+    }
+
+    fputs(prompt, stdout);
+    fflush(stdout);
+
+    char *line = NULL;
+    size_t len = 0;
+    errno = 0;
+
+    for (;;) {
+        if (input_pos == input_len && !fill_input()) {
+            return line;  // EOF; NULL unless a final unterminated line
+        }
+
+        char *start = input_buf + input_pos;
+        char *newline = memchr(start, '\n', input_len - input_pos);
+        size_t chunk = newline ? (size_t)(newline - start) : input_len - input_pos;
+
+        line = realloc(line, len + chunk + 1);
+        if (!line) {
+            fprintf(stderr, "allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(line + len, start, chunk);
+        len += chunk;
+        line[len] = '\0';
+
+        input_pos += chunk + (newline ? 1 : 0);
+        if (newline) {
+            return line;
+        }
+    }
+}
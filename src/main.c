@@ -4,47 +4,89 @@
 #include <signal.h>
 #include <unistd.h>
 
+// Ctrl-C at the prompt: start a fresh line. Runs as a signal handler, so
+// it only write()s the prompt rendered last time.
 void signal_handler(int sig) {
     if (sig == SIGINT) {
-        printf("\n");
-        display_prompt();
-        fflush(stdout);
+        if (write(STDOUT_FILENO, "\n", 1) == -1) return;
+        redraw_prompt();
     }
 }
 
 int main(int argc, char *argv[]) {
     char *input_line = NULL;
+    char *pending = NULL;   // lines of a command still being entered
     int status = 1;
     
     // Initialize shell
     init_shell();
     
-    // Set up signal handling
-    signal(SIGINT, signal_handler);
+    // shell -c 'commands' [name [args...]]
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "shell: -c: option requires an argument\n");
+            return 2;
+        }
+        set_positional_params(argc > 3 ? argv[3] : argv[0], argc > 4 ? argv + 4 : NULL);
+        return run_string(argv[2]);
+    }
     
     // Check if we're running a script
     if (argc > 1) {
+        set_positional_params(argv[1], argv + 2);
         return run_script(argv[1]);
     }
     
     // Interactive mode
+    init_interactive();
+    signal(SIGINT, signal_handler);
     printf("Advanced Shell v1.0 - Type 'help' for commands\n");
     
     do {
-        display_prompt();
-        input_line = read_line();
+        const char *prompt;
+        if (pending) {
+            prompt = get_shell_var("PS2");
+            if (!prompt) prompt = "> ";
+        } else {
+            // Report background jobs that finished since the last prompt
+            update_job_status();
+            prompt = render_prompt();
+        }
+        input_line = read_line(prompt);
         
         if (input_line == NULL) {
+            if (errno == EINTR) {
+                // Ctrl-C: drop the command being entered
+                free(pending);
+                pending = NULL;
+                last_exit_status = 128 + SIGINT;
+                continue;
+            }
+            if (pending) {
+                fprintf(stderr, "shell: syntax error: unexpected end of file\n");
+                free(pending);
+            }
             break;  // EOF (Ctrl+D)
         }
         
-        // Add to history if not empty
-        if (strlen(input_line) > 0) {
-            add_to_history(input_line);
+        // Continue an unfinished command (open quote, {, trailing |, ...)
+        if (pending) {
+            size_t len = strlen(pending);
+            pending = realloc(pending, len + strlen(input_line) + 2);
+            pending[len] = '\n';
+            strcpy(pending + len + 1, input_line);
+            free(input_line);
+            input_line = pending;
+            pending = NULL;
         }
         
         // Handle multi-command input (pipes, &&, ||, ;)
         status = process_complex_command(input_line);
+        if (status == COMMAND_INCOMPLETE) {
+            pending = input_line;
+            status = 1;
+            continue;
+        }
         
         free(input_line);
     } while (status);
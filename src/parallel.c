@@ -0,0 +1,222 @@
+#include "shell.h"
+#include <sched.h>
+#include <sys/mman.h>
+
+// parallel [-j N] command [args] [::: arg...]
+//
+// Runs the command once per argument, keeping N of them going at a time
+// (by default one per CPU this process may run on). `{}` in the command is
+// replaced by the argument, which is otherwise appended. Arguments come
+// after `:::`, or one per line from stdin. Each run's stdout is collected
+// in a memfd and printed in one piece when it exits, so output from
+// different runs never interleaves. The pool is a single job: the runs
+// share its process group, so Ctrl-C reaches all of them, and `parallel
+// ... &` can be listed, stopped and killed with jobs/fg/bg/kill %n.
+//
+// The exit status is the number of failed runs, capped at 101.
+
+#define PARALLEL_MAX_FAILED 101
+
+typedef struct task_slot {
+    pid_t pid;              // 0 when the slot is free
+    int out_fd;             // memfd holding the run's stdout, or -1
+} task_slot_t;
+
+typedef struct arg_source {
+    char **list;            // arguments after :::, or NULL to read stdin
+    char *line;
+    size_t line_size;
+} arg_source_t;
+
+static int online_cpus(void) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        return CPU_COUNT(&set);
+    }
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+// Next argument, or NULL when there are no more. Points into the source.
+static const char *next_arg(arg_source_t *src) {
+    if (src->list) {
+        return *src->list ? *src->list++ : NULL;
+    }
+
+    ssize_t len = getline(&src->line, &src->line_size, stdin);
+    if (len == -1) return NULL;
+    if (len > 0 && src->line[len - 1] == '\n') {
+        src->line[len - 1] = '\0';
+    }
+    return src->line;
+}
+
+// Build one run's argv: {} in any word becomes the argument, and if no
+// word has one the argument is added at the end
+static char **task_argv(char **command, const char *arg) {
+    int count = 0;
+    int substituted = 0;
+    while (command[count]) count++;
+
+    char **argv = malloc((count + 2) * sizeof(char*));
+    for (int i = 0; i < count; i++) {
+        if (strstr(command[i], "{}")) {
+            argv[i] = str_replace(command[i], "{}", arg);
+            substituted = 1;
+        } else {
+            argv[i] = strdup(command[i]);
+        }
+    }
+    if (!substituted) {
+        argv[count++] = strdup(arg);
+    }
+    argv[count] = NULL;
+    return argv;
+}
+
+static void start_task(job_t *job, task_slot_t *slot, char **command,
+                       const char *arg, int stdin_is_args) {
+    char **argv = task_argv(command, arg);
+
+    slot->out_fd = memfd_create("parallel", MFD_CLOEXEC);
+
+    spawn_req_t req;
+    spawn_req_init(&req, argv);
+    req.out_fd = slot->out_fd;
+    req.job = job;
+    if (stdin_is_args) {
+        req.in_file = "/dev/null";  // don't let the runs eat the argument list
+    }
+    if (find_function(argv[0]) || is_builtin(argv[0]) || get_alias(argv[0])) {
+        req.shell_fn = run_command_in_child;
+        req.shell_arg = argv;
+    }
+
+    pid_t pid = spawn_process(&req);
+    slot->pid = pid > 0 ? pid : 0;
+    free_args(argv);
+}
+
+// Print a finished run's output in one piece
+static void flush_task(task_slot_t *slot) {
+    if (slot->out_fd != -1) {
+        fflush(stdout);
+        lseek(slot->out_fd, 0, SEEK_SET);
+        copy_fd(slot->out_fd, STDOUT_FILENO);
+        close(slot->out_fd);
+    }
+    slot->pid = 0;
+    slot->out_fd = -1;
+}
+
+int cmd_parallel(char **args) {
+    int max_running = 0;
+    int i = 1;
+
+    if (args[i] && strncmp(args[i], "-j", 2) == 0) {
+        const char *count = args[i][2] ? args[i] + 2 : args[++i];
+        max_running = count ? atoi(count) : 0;
+        if (max_running <= 0) {
+            printf("parallel: -j needs a positive number\n");
+            last_exit_status = 1;
+            return 1;
+        }
+        i++;
+    }
+    if (max_running == 0) {
+        max_running = online_cpus();
+    }
+
+    // The command is everything up to :::
+    arg_source_t src = { NULL, NULL, 0 };
+    int ncommand = 0;
+    while (args[i + ncommand] && strcmp(args[i + ncommand], ":::") != 0) {
+        ncommand++;
+    }
+    if (args[i + ncommand]) {
+        src.list = args + i + ncommand + 1;
+    }
+    if (ncommand == 0) {
+        printf("Usage: parallel [-j N] command [args] [::: arg...]\n");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    char **command = malloc((ncommand + 1) * sizeof(char*));
+    memcpy(command, args + i, ncommand * sizeof(char*));
+    command[ncommand] = NULL;
+
+    char *text = join_words(args);
+    job_t *job = create_job(text ? text : "parallel", 1);
+    free(text);
+    task_slot_t *slots = malloc(max_running * sizeof(task_slot_t));
+    if (!job || !slots) {
+        perror("parallel");
+        if (job) release_job(job);
+        free(slots);
+        free(command);
+        last_exit_status = 1;
+        return 1;
+    }
+    for (int j = 0; j < max_running; j++) {
+        slots[j].pid = 0;
+        slots[j].out_fd = -1;
+    }
+
+    int running = 0;
+    int failed = 0;
+    int exhausted = 0;
+    int interrupted = 0;
+    for (;;) {
+        // Fill every free slot
+        for (int j = 0; j < max_running && !exhausted && !interrupted; j++) {
+            if (slots[j].pid) continue;
+            const char *arg = next_arg(&src);
+            if (!arg) {
+                exhausted = 1;
+                break;
+            }
+
+            start_task(job, &slots[j], command, arg, !src.list);
+            if (slots[j].pid) {
+                running++;
+            } else {
+                flush_task(&slots[j]);
+                failed++;
+            }
+        }
+        if (running == 0) {
+            if (exhausted || interrupted) break;
+            continue;
+        }
+
+        int status;
+        pid_t pid = wait_for_job_process(job, &status);
+        if (pid == -1) break;
+
+        for (int j = 0; j < max_running; j++) {
+            if (slots[j].pid == pid) {
+                flush_task(&slots[j]);
+                running--;
+                break;
+            }
+        }
+        if (status != 0) failed++;
+        // Ctrl-C went to the whole pool; don't start anything new
+        if (status == 128 + SIGINT) interrupted = 1;
+    }
+
+    for (int j = 0; j < max_running; j++) {
+        if (slots[j].pid) flush_task(&slots[j]);
+    }
+    free(slots);
+    free(src.line);
+    free(command);
+    release_job(job);
+    if (interrupted && job_control) {
+        putchar('\n');  // keep the prompt off the ^C line
+    }
+
+    last_exit_status = failed < PARALLEL_MAX_FAILED ? failed : PARALLEL_MAX_FAILED;
+    return 1;
+}
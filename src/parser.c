@@ -0,0 +1,758 @@
+#include "shell.h"
+
+// Single-pass lexer and recursive-descent parser. A command line is read
+// once, left to right; the lexer hands out tokens on demand and the parser
+// builds the tree as they arrive. Words are kept exactly as written
+// (quotes included) and copied once into the tree's arena; quote removal
+// and expansion happen when the word is executed.
+//
+// Grammar:
+//   list     : and_or ((';' | '&' | NEWLINE) and_or)* [';' | '&']
+//   and_or   : pipeline (('&&' | '||') linebreak pipeline)*
+//   pipeline : ['time'] command ('|' linebreak command)*
+//   command  : simple | group | funcdef | loop
+//   simple   : (WORD | redirect)+
+//   group    : '{' list '}'
+//   funcdef  : WORD '(' ')' linebreak group
+//   loop     : ('while' | 'until') list 'do' list 'done'
+//   redirect : [IO_NUMBER] ('<' | '>' | '>>' | '<<' | '<<-' | '<<<') WORD
+//
+// A word may contain $(...) or `...`; the lexer only finds where the
+// substitution ends, and its text is parsed again when it is expanded.
+// IO_NUMBER is a word of digits written right against < or >, as in
+// 2>errors; it says which descriptor the redirection applies to.
+// The body of a here-document is read by the lexer too: when it reaches
+// the end of a line on which << or <<- appeared, the lines that follow up
+// to each delimiter are taken as the bodies, in order.
+
+#define ARENA_BLOCK_SIZE 4096
+#define MAX_PENDING_HEREDOCS 16
+#define ARENA_ALIGN 16
+#define ARENA_HEADER ((sizeof(arena_block_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t size;
+} arena_block_t;
+
+typedef enum {
+    TOK_WORD,
+    TOK_IO_NUMBER,  // digits directly before < or >, as in 2>file
+    TOK_PIPE,       // |
+    TOK_AND_IF,     // &&
+    TOK_OR_IF,      // ||
+    TOK_SEMI,       // ;
+    TOK_AMP,        // &
+    TOK_NEWLINE,
+    TOK_LESS,       // <
+    TOK_GREAT,      // >
+    TOK_DGREAT,     // >>
+    TOK_DLESS,      // <<
+    TOK_DLESSDASH,  // <<-
+    TOK_TLESS,      // <<<
+    TOK_LPAREN,     // (
+    TOK_RPAREN,     // )
+    TOK_EOF,
+    TOK_INCOMPLETE  // unterminated quote or trailing backslash
+} token_type_t;
+
+typedef struct token {
+    token_type_t type;
+    const char *start;
+    size_t len;
+} token_t;
+
+// A here-document whose body starts after the current line
+typedef struct pending_heredoc {
+    redirect_t *redir;
+    int strip_tabs;         // <<-
+} pending_heredoc_t;
+
+typedef struct parser {
+    const char *pos;
+    token_t tok;            // one token of lookahead
+    parse_tree_t *tree;
+    int status;
+    pending_heredoc_t heredocs[MAX_PENDING_HEREDOCS];
+    int nheredocs;
+} parser_t;
+
+// Small pointer vector used while a node's children are being collected
+typedef struct ptr_vec {
+    void **items;
+    int count;
+    int capacity;
+    void *inline_items[16];
+} ptr_vec_t;
+
+// Arena
+
+static void *arena_alloc(parse_tree_t *tree, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    arena_block_t *block = tree->arena;
+    if (!block || block->used + size > block->size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(ARENA_HEADER + block_size);
+        if (!block) {
+            fprintf(stderr, "allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        block->next = tree->arena;
+        block->used = 0;
+        block->size = block_size;
+        tree->arena = block;
+    }
+
+    void *ptr = (char *)block + ARENA_HEADER + block->used;
+    block->used += size;
+    return ptr;
+}
+
+static char *arena_strndup(parse_tree_t *tree, const char *str, size_t len) {
+    char *copy = arena_alloc(tree, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+static void vec_init(ptr_vec_t *vec) {
+    vec->items = vec->inline_items;
+    vec->count = 0;
+    vec->capacity = 16;
+}
+
+static void vec_push(ptr_vec_t *vec, void *item) {
+    if (vec->count == vec->capacity) {
+        vec->capacity *= 2;
+        if (vec->items == vec->inline_items) {
+            vec->items = malloc(vec->capacity * sizeof(void*));
+            memcpy(vec->items, vec->inline_items, vec->count * sizeof(void*));
+        } else {
+            vec->items = realloc(vec->items, vec->capacity * sizeof(void*));
+        }
+        if (!vec->items) {
+            fprintf(stderr, "allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    vec->items[vec->count++] = item;
+}
+
+// Move the collected items into the arena, NULL-terminated
+static void **vec_finish(ptr_vec_t *vec, parse_tree_t *tree) {
+    void **items = arena_alloc(tree, (vec->count + 1) * sizeof(void*));
+    memcpy(items, vec->items, vec->count * sizeof(void*));
+    items[vec->count] = NULL;
+    if (vec->items != vec->inline_items) free(vec->items);
+    return items;
+}
+
+// Lexer
+
+static int is_metachar(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == ';' || c == '&' ||
+           c == '|' || c == '<' || c == '>' || c == '(' || c == ')';
+}
+
+static const char *skip_double_quoted(const char *s);
+
+// Given s at the "$(" or "`" opening a command substitution, return the
+// character after the matching close, or NULL if the input ends first.
+// Quotes and nested substitutions inside are stepped over as units.
+const char *skip_substitution(const char *s) {
+    if (*s == '`') {
+        for (s++; *s && *s != '`'; s++) {
+            if (*s == '\\' && s[1]) s++;
+        }
+        return *s ? s + 1 : NULL;
+    }
+
+    int depth = 0;
+    for (s++; *s; ) {
+        if (*s == '\\') {
+            if (!s[1]) return NULL;
+            s += 2;
+        } else if (*s == '\'') {
+            const char *close = strchr(s + 1, '\'');
+            if (!close) return NULL;
+            s = close + 1;
+        } else if (*s == '"') {
+            s = skip_double_quoted(s);
+            if (!s) return NULL;
+        } else if (*s == '`' || (*s == '$' && s[1] == '(')) {
+            s = skip_substitution(s);
+            if (!s) return NULL;
+        } else {
+            if (*s == '(') {
+                depth++;
+            } else if (*s == ')' && --depth == 0) {
+                return s + 1;
+            }
+            s++;
+        }
+    }
+    return NULL;
+}
+
+// Past the closing quote of the double-quoted section at s, or NULL
+static const char *skip_double_quoted(const char *s) {
+    for (s++; *s && *s != '"'; ) {
+        if (*s == '\\' && s[1]) {
+            s += 2;
+        } else if (*s == '`' || (*s == '$' && s[1] == '(')) {
+            s = skip_substitution(s);
+            if (!s) return NULL;
+        } else {
+            s++;
+        }
+    }
+    return *s ? s + 1 : NULL;
+}
+
+// Scan the rest of a word, stepping over quoted sections and command
+// substitutions as units
+static int scan_word(parser_t *p) {
+    const char *s = p->pos;
+
+    while (*s && !is_metachar(*s)) {
+        if (*s == '\\') {
+            if (!s[1]) return 0;
+            s += 2;
+        } else if (*s == '\'') {
+            const char *close = strchr(s + 1, '\'');
+            if (!close) return 0;
+            s = close + 1;
+        } else if (*s == '"') {
+            s = skip_double_quoted(s);
+            if (!s) return 0;
+        } else if (*s == '`' || (*s == '$' && s[1] == '(')) {
+            s = skip_substitution(s);
+            if (!s) return 0;
+        } else {
+            s++;
+        }
+    }
+
+    p->pos = s;
+    return 1;
+}
+
+// Does the line at s, up to len bytes, read exactly delim?
+static int is_delimiter_line(const char *s, size_t len, const char *delim) {
+    return strlen(delim) == len && strncmp(s, delim, len) == 0;
+}
+
+// Start of the next body line of doc at s, with <<- tabs skipped
+static const char *heredoc_line(const pending_heredoc_t *doc, const char *s) {
+    if (doc->strip_tabs) {
+        while (*s == '\t') s++;
+    }
+    return s;
+}
+
+// Read the bodies of the here-documents opened on the line just ended,
+// starting at p->pos. Returns 0 if the input ends before a delimiter.
+static int read_heredoc_bodies(parser_t *p) {
+    for (int i = 0; i < p->nheredocs; i++) {
+        pending_heredoc_t *doc = &p->heredocs[i];
+        const char *start = p->pos;
+        const char *line = start;
+
+        // Find the delimiter line first, so the body can be sized exactly
+        for (;;) {
+            const char *text = heredoc_line(doc, line);
+            const char *eol = strchr(text, '\n');
+            size_t len = eol ? (size_t)(eol - text) : strlen(text);
+
+            if (is_delimiter_line(text, len, doc->redir->target)) {
+                p->pos = eol ? eol + 1 : text + len;
+                break;
+            }
+            if (!eol) return 0;
+            line = eol + 1;
+        }
+
+        if (!doc->strip_tabs) {
+            doc->redir->body = arena_strndup(p->tree, start, line - start);
+            continue;
+        }
+
+        char *body = arena_alloc(p->tree, line - start + 1);
+        size_t len = 0;
+        for (const char *s = start; s < line; ) {
+            const char *text = heredoc_line(doc, s);
+            const char *eol = strchr(text, '\n');
+            memcpy(body + len, text, eol - text + 1);
+            len += eol - text + 1;
+            s = eol + 1;
+        }
+        body[len] = '\0';
+        doc->redir->body = body;
+    }
+    p->nheredocs = 0;
+    return 1;
+}
+
+// Digits alone, followed straight away by a redirection operator, name the
+// descriptor to redirect rather than being a word of the command
+static int is_io_number(const char *s, size_t len, char next) {
+    if (next != '<' && next != '>') return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!isdigit((unsigned char)s[i])) return 0;
+    }
+    return 1;
+}
+
+static void next_token(parser_t *p) {
+    const char *s = p->pos;
+
+    // Blanks, line continuations and comments
+    for (;;) {
+        if (*s == ' ' || *s == '\t' || *s == '\r') {
+            s++;
+        } else if (*s == '\\' && s[1] == '\n') {
+            s += 2;
+        } else if (*s == '#') {
+            while (*s && *s != '\n') s++;
+        } else {
+            break;
+        }
+    }
+
+    token_t *tok = &p->tok;
+    tok->start = s;
+    tok->len = 1;
+
+    switch (*s) {
+    case '\0':
+        // A here-document still waiting for its body needs more lines
+        tok->type = p->nheredocs ? TOK_INCOMPLETE : TOK_EOF;
+        tok->len = 0;
+        break;
+    case '\n':
+        tok->type = TOK_NEWLINE;
+        break;
+    case ';':
+        tok->type = TOK_SEMI;
+        break;
+    case '(':
+        tok->type = TOK_LPAREN;
+        break;
+    case ')':
+        tok->type = TOK_RPAREN;
+        break;
+    case '<':
+        if (s[1] != '<') {
+            tok->type = TOK_LESS;
+        } else if (s[2] == '<') {
+            tok->type = TOK_TLESS;
+            tok->len = 3;
+        } else if (s[2] == '-') {
+            tok->type = TOK_DLESSDASH;
+            tok->len = 3;
+        } else {
+            tok->type = TOK_DLESS;
+            tok->len = 2;
+        }
+        break;
+    case '|':
+        tok->type = s[1] == '|' ? TOK_OR_IF : TOK_PIPE;
+        break;
+    case '&':
+        tok->type = s[1] == '&' ? TOK_AND_IF : TOK_AMP;
+        break;
+    case '>':
+        tok->type = s[1] == '>' ? TOK_DGREAT : TOK_GREAT;
+        break;
+    default:
+        p->pos = s;
+        if (!scan_word(p)) {
+            tok->type = TOK_INCOMPLETE;
+            tok->len = 0;
+            return;
+        }
+        tok->len = p->pos - s;
+        tok->type = is_io_number(s, tok->len, *p->pos) ? TOK_IO_NUMBER : TOK_WORD;
+        return;
+    }
+
+    if (tok->type == TOK_OR_IF || tok->type == TOK_AND_IF || tok->type == TOK_DGREAT) {
+        tok->len = 2;
+    }
+    p->pos = s + tok->len;
+
+    if (tok->type == TOK_NEWLINE && p->nheredocs && !read_heredoc_bodies(p)) {
+        tok->type = TOK_INCOMPLETE;
+    }
+}
+
+// Parser
+
+static void syntax_error(parser_t *p) {
+    if (p->status != PARSE_OK) return;
+
+    if (p->tok.type == TOK_EOF || p->tok.type == TOK_INCOMPLETE) {
+        // Running out of input mid-construct: more lines may complete it
+        p->status = PARSE_INCOMPLETE;
+        return;
+    }
+
+    p->status = PARSE_ERROR;
+    if (p->tok.type == TOK_NEWLINE) {
+        fprintf(stderr, "shell: syntax error near unexpected token `newline'\n");
+    } else {
+        fprintf(stderr, "shell: syntax error near unexpected token `%.*s'\n",
+                (int)p->tok.len, p->tok.start);
+    }
+}
+
+static node_t *new_node(parser_t *p, node_type_t type) {
+    node_t *node = arena_alloc(p->tree, sizeof(node_t));
+    memset(node, 0, sizeof(node_t));
+    node->type = type;
+    return node;
+}
+
+static node_t *new_binary(parser_t *p, node_type_t type, node_t *left, node_t *right) {
+    node_t *node = new_node(p, type);
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+static void skip_newlines(parser_t *p) {
+    while (p->tok.type == TOK_NEWLINE) next_token(p);
+}
+
+static int is_redirect_token(token_type_t type) {
+    return type == TOK_LESS || type == TOK_GREAT || type == TOK_DGREAT ||
+           type == TOK_DLESS || type == TOK_DLESSDASH || type == TOK_TLESS;
+}
+
+// Take the delimiter of a here-document from its word: quotes are removed,
+// and any quoting at all means the body is used as written
+static void set_heredoc_delimiter(parser_t *p, redirect_t *redir, int strip_tabs) {
+    char *delim = arena_alloc(p->tree, p->tok.len + 1);
+    size_t len = 0;
+    for (size_t i = 0; i < p->tok.len; i++) {
+        char c = p->tok.start[i];
+        if (c == '\'' || c == '"') {
+            redir->quoted = 1;
+        } else if (c == '\\' && i + 1 < p->tok.len) {
+            redir->quoted = 1;
+            delim[len++] = p->tok.start[++i];
+        } else {
+            delim[len++] = c;
+        }
+    }
+    delim[len] = '\0';
+    redir->target = delim;
+
+    if (p->nheredocs == MAX_PENDING_HEREDOCS) {
+        fprintf(stderr, "shell: too many here-documents on one line\n");
+        p->status = PARSE_ERROR;
+        return;
+    }
+    p->heredocs[p->nheredocs].redir = redir;
+    p->heredocs[p->nheredocs].strip_tabs = strip_tabs;
+    p->nheredocs++;
+}
+
+static int token_is(parser_t *p, const char *word) {
+    return p->tok.type == TOK_WORD && p->tok.len == strlen(word) &&
+           strncmp(p->tok.start, word, p->tok.len) == 0;
+}
+
+static int starts_command(parser_t *p) {
+    // Reserved words that close a group or a loop
+    if (token_is(p, "}") || token_is(p, "do") || token_is(p, "done")) return 0;
+    return p->tok.type == TOK_WORD || p->tok.type == TOK_IO_NUMBER ||
+           is_redirect_token(p->tok.type);
+}
+
+// Is the next unread character, past blanks, an opening parenthesis?
+static int next_is_lparen(parser_t *p) {
+    const char *s = p->pos;
+    while (*s == ' ' || *s == '\t') s++;
+    return *s == '(';
+}
+
+static node_t *parse_list(parser_t *p);
+
+// The descriptor named by an IO_NUMBER token, or -1 after reporting one out
+// of range. Descriptors from 10 up are where the shell keeps its own.
+static int io_number(parser_t *p) {
+    int fd = 0;
+    for (size_t i = 0; i < p->tok.len && fd <= MAX_REDIRECT_FD; i++) {
+        fd = fd * 10 + (p->tok.start[i] - '0');
+    }
+    if (fd > MAX_REDIRECT_FD) {
+        fprintf(stderr, "shell: %.*s: bad file descriptor\n", (int)p->tok.len, p->tok.start);
+        p->status = PARSE_ERROR;
+        return -1;
+    }
+    return fd;
+}
+
+static node_t *parse_simple_command(parser_t *p) {
+    node_t *node = new_node(p, NODE_COMMAND);
+    redirect_t **tail = &node->redirects;
+    ptr_vec_t words;
+    vec_init(&words);
+
+    for (;;) {
+        if (p->tok.type == TOK_WORD) {
+            vec_push(&words, arena_strndup(p->tree, p->tok.start, p->tok.len));
+            next_token(p);
+        } else if (p->tok.type == TOK_IO_NUMBER || is_redirect_token(p->tok.type)) {
+            int fd = -1;
+            if (p->tok.type == TOK_IO_NUMBER) {
+                fd = io_number(p);
+                if (fd == -1) break;
+                next_token(p);
+            }
+
+            token_type_t op = p->tok.type;
+            redirect_t *redir = arena_alloc(p->tree, sizeof(redirect_t));
+            memset(redir, 0, sizeof(redirect_t));
+            switch (op) {
+            case TOK_LESS:   redir->type = REDIR_INPUT; break;
+            case TOK_GREAT:  redir->type = REDIR_OUTPUT; break;
+            case TOK_DGREAT: redir->type = REDIR_APPEND; break;
+            case TOK_TLESS:  redir->type = REDIR_HERESTRING; break;
+            default:         redir->type = REDIR_HEREDOC; break;
+            }
+            if (fd == -1) {
+                fd = (op == TOK_GREAT || op == TOK_DGREAT) ? 1 : 0;
+            }
+            redir->fd = fd;
+
+            next_token(p);
+            if (p->tok.type != TOK_WORD) {
+                syntax_error(p);
+                break;
+            }
+            if (redir->type == REDIR_HEREDOC) {
+                set_heredoc_delimiter(p, redir, op == TOK_DLESSDASH);
+                if (p->status != PARSE_OK) break;
+            } else {
+                redir->target = arena_strndup(p->tree, p->tok.start, p->tok.len);
+            }
+            *tail = redir;
+            tail = &redir->next;
+            next_token(p);
+        } else {
+            break;
+        }
+    }
+
+    if (p->status == PARSE_OK && words.count == 0 && !node->redirects) {
+        syntax_error(p);
+    }
+
+    node->words = (char **)vec_finish(&words, p->tree);
+    return p->status == PARSE_OK ? node : NULL;
+}
+
+static node_t *parse_group(parser_t *p) {
+    next_token(p);  // {
+    node_t *body = parse_list(p);
+    if (p->status != PARSE_OK) return NULL;
+
+    if (!body || !token_is(p, "}")) {
+        syntax_error(p);
+        return NULL;
+    }
+    next_token(p);
+
+    node_t *node = new_node(p, NODE_GROUP);
+    node->left = body;
+    return node;
+}
+
+static node_t *parse_function(parser_t *p) {
+    node_t *node = new_node(p, NODE_FUNCTION);
+    node->words = arena_alloc(p->tree, 2 * sizeof(char*));
+    node->words[0] = arena_strndup(p->tree, p->tok.start, p->tok.len);
+    node->words[1] = NULL;
+    node->tree = p->tree;
+
+    next_token(p);  // name
+    next_token(p);  // (
+    if (p->tok.type != TOK_RPAREN) {
+        syntax_error(p);
+        return NULL;
+    }
+    next_token(p);
+    skip_newlines(p);
+
+    if (!token_is(p, "{")) {
+        syntax_error(p);
+        return NULL;
+    }
+    node->left = parse_group(p);
+    return node->left ? node : NULL;
+}
+
+static node_t *parse_loop(parser_t *p) {
+    node_type_t type = token_is(p, "while") ? NODE_WHILE : NODE_UNTIL;
+    next_token(p);
+
+    node_t *condition = parse_list(p);
+    if (p->status != PARSE_OK) return NULL;
+    if (!condition || !token_is(p, "do")) {
+        syntax_error(p);
+        return NULL;
+    }
+    next_token(p);
+
+    node_t *body = parse_list(p);
+    if (p->status != PARSE_OK) return NULL;
+    if (!body || !token_is(p, "done")) {
+        syntax_error(p);
+        return NULL;
+    }
+    next_token(p);
+
+    return new_binary(p, type, condition, body);
+}
+
+static node_t *parse_command(parser_t *p) {
+    if (token_is(p, "{")) {
+        return parse_group(p);
+    }
+    if ((token_is(p, "while") || token_is(p, "until")) && !next_is_lparen(p)) {
+        return parse_loop(p);
+    }
+    if (p->tok.type == TOK_WORD && next_is_lparen(p)) {
+        return parse_function(p);
+    }
+    return parse_simple_command(p);
+}
+
+static node_t *parse_pipeline(parser_t *p) {
+    // time is a reserved word so that it can cover a whole pipeline
+    if (token_is(p, "time") && !next_is_lparen(p)) {
+        node_t *node = new_node(p, NODE_TIME);
+        next_token(p);
+        if (starts_command(p)) {
+            node->left = parse_pipeline(p);
+            if (!node->left) return NULL;
+        }
+        return node;
+    }
+
+    node_t *first = parse_command(p);
+    if (!first || p->tok.type != TOK_PIPE) return first;
+
+    ptr_vec_t stages;
+    vec_init(&stages);
+    vec_push(&stages, first);
+
+    while (p->tok.type == TOK_PIPE) {
+        next_token(p);
+        skip_newlines(p);
+
+        node_t *stage = parse_command(p);
+        if (!stage) break;
+        vec_push(&stages, stage);
+    }
+
+    node_t *node = new_node(p, NODE_PIPELINE);
+    node->nchildren = stages.count;
+    node->children = (node_t **)vec_finish(&stages, p->tree);
+    return p->status == PARSE_OK ? node : NULL;
+}
+
+static node_t *parse_and_or(parser_t *p) {
+    node_t *left = parse_pipeline(p);
+
+    while (left && (p->tok.type == TOK_AND_IF || p->tok.type == TOK_OR_IF)) {
+        node_type_t type = p->tok.type == TOK_AND_IF ? NODE_AND : NODE_OR;
+        next_token(p);
+        skip_newlines(p);
+
+        node_t *right = parse_pipeline(p);
+        if (!right) return NULL;
+        left = new_binary(p, type, left, right);
+    }
+
+    return left;
+}
+
+static node_t *parse_list(parser_t *p) {
+    node_t *list = NULL;
+
+    skip_newlines(p);
+    while (starts_command(p)) {
+        node_t *item = parse_and_or(p);
+        if (!item) return NULL;
+
+        if (p->tok.type == TOK_AMP) {
+            item = new_binary(p, NODE_BACKGROUND, item, NULL);
+            next_token(p);
+        } else if (p->tok.type == TOK_SEMI) {
+            next_token(p);
+        } else if (p->tok.type != TOK_NEWLINE && p->tok.type != TOK_EOF &&
+                   !token_is(p, "}")) {
+            syntax_error(p);
+            return NULL;
+        }
+        skip_newlines(p);
+
+        list = list ? new_binary(p, NODE_SEQUENCE, list, item) : item;
+    }
+
+    return list;
+}
+
+parse_tree_t *parse_command_line(const char *line, int *status) {
+    parse_tree_t *tree = malloc(sizeof(parse_tree_t));
+    if (!tree) {
+        fprintf(stderr, "allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    tree->arena = NULL;
+    tree->root = NULL;
+    tree->refs = 1;
+
+    parser_t p;
+    p.pos = line;
+    p.tree = tree;
+    p.status = PARSE_OK;
+    p.nheredocs = 0;
+    next_token(&p);
+
+    tree->root = parse_list(&p);
+    if (p.status == PARSE_OK && p.tok.type != TOK_EOF) {
+        syntax_error(&p);
+    }
+
+    *status = p.status;
+    if (p.status != PARSE_OK) {
+        free_parse_tree(tree);
+        return NULL;
+    }
+    return tree;
+}
+
+// Function definitions and the script cache keep trees alive past the
+// command line that produced them
+void retain_parse_tree(parse_tree_t *tree) {
+    tree->refs++;
+}
+
+// Drop a reference, freeing the tree with the last one
+void free_parse_tree(parse_tree_t *tree) {
+    if (!tree || --tree->refs > 0) return;
+
+    arena_block_t *block = tree->arena;
+    while (block) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(tree);
+}
@@ -0,0 +1,323 @@
+#include "shell.h"
+#include <limits.h>
+#include <pthread.h>
+
+// Prompt rendering. PS1 is compiled into a list of segments once, when it
+// changes, and each prompt just walks the list. Nothing on the way asks
+// the kernel: the hostname is looked up once, the directory comes from
+// $PWD (which cd keeps current) and the job count from the job table.
+//
+// PS1 escapes:
+//   \u user   \h host up to the first '.'   \H host   \w directory, with
+//   ~ for $HOME   \W last part of it   \j number of jobs   \? last exit
+//   status   \$ '#' for root, else '$'   \g git branch   \n newline
+//   \e escape   \[ \] (ignored; they bracket non-printing text)   \\ backslash
+//
+// A PS1 without escapes keeps the classic prompt: user@host:cwd in colour,
+// followed by PS1.
+//
+// Segments that may be slow (\g walks up the tree reading files, which can
+// stall on a network filesystem) run on a worker thread. The prompt waits
+// for them at most PROMPT_SEGMENT_TIMEOUT_MS; past that it shows the last
+// value computed for the same directory, and the fresh one appears at the
+// next prompt.
+
+#define PROMPT_MAX 4096
+#define PROMPT_SEGMENT_TIMEOUT_MS 20
+
+typedef enum {
+    SEG_TEXT,
+    SEG_USER,
+    SEG_HOST_SHORT,
+    SEG_HOST,
+    SEG_CWD,                // ~ abbreviated
+    SEG_CWD_FULL,
+    SEG_CWD_BASE,
+    SEG_JOBS,
+    SEG_STATUS,
+    SEG_PROMPT_CHAR,
+    SEG_GIT_BRANCH
+} segment_type_t;
+
+typedef struct segment {
+    segment_type_t type;
+    char *text;             // SEG_TEXT
+} segment_t;
+
+static segment_t *segments = NULL;
+static int segment_count = 0;
+static int compiled = 0;
+
+static char hostname[256];
+static int have_hostname = 0;
+
+// The last rendered prompt, for redrawing it from a signal handler. Two
+// buffers so the handler never sees one half written.
+static char rendered[2][PROMPT_MAX];
+static volatile sig_atomic_t shown = -1;
+
+// Asynchronous git branch lookup
+static pthread_mutex_t branch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t branch_done = PTHREAD_COND_INITIALIZER;
+static int branch_busy = 0;
+static char *branch_dir = NULL;         // directory the value belongs to
+static char *branch_value = NULL;
+
+static void free_segments(void) {
+    for (int i = 0; i < segment_count; i++) {
+        free(segments[i].text);
+    }
+    free(segments);
+    segments = NULL;
+    segment_count = 0;
+}
+
+static void add_segment(segment_type_t type, const char *text, size_t len) {
+    // Runs of text merge into one segment
+    if (type == SEG_TEXT && segment_count > 0 && segments[segment_count - 1].type == SEG_TEXT) {
+        segment_t *last = &segments[segment_count - 1];
+        size_t old_len = strlen(last->text);
+        last->text = realloc(last->text, old_len + len + 1);
+        memcpy(last->text + old_len, text, len);
+        last->text[old_len + len] = '\0';
+        return;
+    }
+
+    segments = realloc(segments, (segment_count + 1) * sizeof(segment_t));
+    segments[segment_count].type = type;
+    segments[segment_count].text = type == SEG_TEXT ? strndup(text, len) : NULL;
+    segment_count++;
+}
+
+static void compile_prompt(const char *ps1) {
+    free_segments();
+    compiled = 1;
+
+    if (!strchr(ps1, '\\')) {
+        add_segment(SEG_TEXT, COLOR_GREEN, strlen(COLOR_GREEN));
+        add_segment(SEG_USER, NULL, 0);
+        add_segment(SEG_TEXT, "@", 1);
+        add_segment(SEG_HOST, NULL, 0);
+        add_segment(SEG_TEXT, COLOR_RESET ":" COLOR_BLUE, strlen(COLOR_RESET ":" COLOR_BLUE));
+        add_segment(SEG_CWD_FULL, NULL, 0);
+        add_segment(SEG_TEXT, COLOR_RESET " ", strlen(COLOR_RESET " "));
+        add_segment(SEG_TEXT, ps1, strlen(ps1));
+        return;
+    }
+
+    const char *text = ps1;
+    for (const char *s = ps1; *s; s++) {
+        if (*s != '\\' || !s[1]) continue;
+
+        add_segment(SEG_TEXT, text, s - text);
+        text = s + 2;
+        switch (s[1]) {
+        case 'u': add_segment(SEG_USER, NULL, 0); break;
+        case 'h': add_segment(SEG_HOST_SHORT, NULL, 0); break;
+        case 'H': add_segment(SEG_HOST, NULL, 0); break;
+        case 'w': add_segment(SEG_CWD, NULL, 0); break;
+        case 'W': add_segment(SEG_CWD_BASE, NULL, 0); break;
+        case 'j': add_segment(SEG_JOBS, NULL, 0); break;
+        case '?': add_segment(SEG_STATUS, NULL, 0); break;
+        case '$': add_segment(SEG_PROMPT_CHAR, NULL, 0); break;
+        case 'g': add_segment(SEG_GIT_BRANCH, NULL, 0); break;
+        case 'n': add_segment(SEG_TEXT, "\n", 1); break;
+        case 'e': add_segment(SEG_TEXT, "\033", 1); break;
+        case '\\': add_segment(SEG_TEXT, "\\", 1); break;
+        case '[':
+        case ']':
+            break;
+        default:
+            text = s;       // unknown escape: keep it as written
+            break;
+        }
+        s++;
+    }
+    add_segment(SEG_TEXT, text, strlen(text));
+}
+
+// PS1 was set or unset
+void prompt_invalidate(void) {
+    compiled = 0;
+}
+
+// Name of the branch checked out in the repository containing dir, or NULL
+static char *find_git_branch(const char *dir) {
+    size_t len = strlen(dir);
+    char *path = malloc(len + sizeof("/.git/HEAD"));
+    memcpy(path, dir, len + 1);
+
+    char *branch = NULL;
+    for (;;) {
+        strcpy(path + len, "/.git/HEAD");
+        FILE *head = fopen(path, "r");
+        if (head) {
+            char line[256];
+            if (fgets(line, sizeof(line), head)) {
+                line[strcspn(line, "\n")] = '\0';
+                if (strncmp(line, "ref: refs/heads/", 16) == 0) {
+                    branch = strdup(line + 16);
+                } else {
+                    branch = strndup(line, 7);      // detached: short hash
+                }
+            }
+            fclose(head);
+            break;
+        }
+
+        // Up one directory
+        while (len > 0 && path[len - 1] != '/') len--;
+        if (len <= 1) break;
+        len--;
+    }
+
+    free(path);
+    return branch;
+}
+
+static void *branch_worker(void *arg) {
+    char *dir = arg;
+    char *branch = find_git_branch(dir);
+
+    pthread_mutex_lock(&branch_lock);
+    free(branch_dir);
+    free(branch_value);
+    branch_dir = dir;
+    branch_value = branch;
+    branch_busy = 0;
+    pthread_cond_broadcast(&branch_done);
+    pthread_mutex_unlock(&branch_lock);
+    return NULL;
+}
+
+// Append the git branch for cwd, waiting a little for a fresh lookup
+static void render_git_branch(FILE *out, const char *cwd) {
+    pthread_mutex_lock(&branch_lock);
+
+    if (!branch_busy) {
+        pthread_t thread;
+        char *dir = strdup(cwd);
+        if (dir && pthread_create(&thread, NULL, branch_worker, dir) == 0) {
+            pthread_detach(thread);
+            branch_busy = 1;
+        } else {
+            free(dir);
+        }
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += PROMPT_SEGMENT_TIMEOUT_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (branch_busy) {
+        if (pthread_cond_timedwait(&branch_done, &branch_lock, &deadline) != 0) break;
+    }
+
+    if (branch_value && branch_dir && strcmp(branch_dir, cwd) == 0) {
+        fputs(branch_value, out);
+    }
+    pthread_mutex_unlock(&branch_lock);
+}
+
+static const char *current_dir(void) {
+    char *pwd = get_shell_var("PWD");
+    if (pwd) return pwd;
+
+    // First prompt: learn it once; cd keeps it up to date from here on
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) return "unknown";
+    set_shell_var("PWD", cwd);
+    return get_shell_var("PWD");
+}
+
+static void render_segment(FILE *out, const segment_t *seg) {
+    const char *cwd, *home, *user;
+    size_t home_len;
+
+    switch (seg->type) {
+    case SEG_TEXT:
+        fputs(seg->text, out);
+        break;
+    case SEG_USER:
+        user = get_shell_var("USER");
+        fputs(user ? user : "user", out);
+        break;
+    case SEG_HOST_SHORT:
+        fprintf(out, "%.*s", (int)strcspn(hostname, "."), hostname);
+        break;
+    case SEG_HOST:
+        fputs(hostname, out);
+        break;
+    case SEG_CWD:
+        cwd = current_dir();
+        home = get_shell_var("HOME");
+        home_len = home ? strlen(home) : 0;
+        if (home_len > 1 && strncmp(cwd, home, home_len) == 0 &&
+            (cwd[home_len] == '/' || cwd[home_len] == '\0')) {
+            fprintf(out, "~%s", cwd + home_len);
+        } else {
+            fputs(cwd, out);
+        }
+        break;
+    case SEG_CWD_FULL:
+        fputs(current_dir(), out);
+        break;
+    case SEG_CWD_BASE:
+        cwd = current_dir();
+        fputs(strcmp(cwd, "/") == 0 ? cwd : strrchr(cwd, '/') ? strrchr(cwd, '/') + 1 : cwd, out);
+        break;
+    case SEG_JOBS:
+        fprintf(out, "%d", job_count());
+        break;
+    case SEG_STATUS:
+        fprintf(out, "%d", last_exit_status);
+        break;
+    case SEG_PROMPT_CHAR:
+        fputc(geteuid() == 0 ? '#' : '$', out);
+        break;
+    case SEG_GIT_BRANCH:
+        render_git_branch(out, current_dir());
+        break;
+    }
+}
+
+// Render the prompt for the next command line
+const char *render_prompt(void) {
+    if (!have_hostname) {
+        if (gethostname(hostname, sizeof(hostname)) != 0) {
+            strcpy(hostname, "unknown");
+        }
+        hostname[sizeof(hostname) - 1] = '\0';
+        have_hostname = 1;
+    }
+    if (!compiled) {
+        char *ps1 = get_shell_var("PS1");
+        compile_prompt(ps1 ? ps1 : "$ ");
+    }
+
+    int next = shown == 0 ? 1 : 0;
+    FILE *out = fmemopen(rendered[next], PROMPT_MAX, "w");
+    if (!out) return "$ ";
+    for (int i = 0; i < segment_count; i++) {
+        render_segment(out, &segments[i]);
+    }
+    fclose(out);
+    rendered[next][PROMPT_MAX - 1] = '\0';
+    shown = next;
+    return rendered[next];
+}
+
+// Print the last prompt again. Only uses write(), so it is safe to call
+// from a signal handler.
+void redraw_prompt(void) {
+    int current = shown;
+    if (current >= 0) {
+        const char *text = rendered[current];
+        if (write(STDOUT_FILENO, text, strlen(text)) == -1) {
+            // Nothing sensible to do about a failed prompt
+        }
+    }
+}
@@ -2,80 +2,63 @@
 
 // Global variables
 job_t *job_list = NULL;
-alias_t aliases[MAX_ALIASES];
-shell_var_t shell_vars[MAX_VARS];
-char *history[MAX_HISTORY];
-int history_count = 0;
-int alias_count = 0;
-int var_count = 0;
+hash_table_t alias_table;
+hash_table_t var_table;
+history_ring_t history = { NULL, 0, 0, 0, 1 };
+int last_exit_status = 0;
+int exit_requested = 0;
+int job_control = 0;
+pid_t shell_pid = 0;
+pid_t last_background_pid = 0;
 
 void init_shell(void) {
-    // Initialize variables
+    shell_pid = getpid();
+
+    // Import the environment, so a variable is always one table lookup.
+    // PS1 is ours: an inherited one is usually written for another shell.
+    // Exporting repoints environ, so walk the inherited array we started with.
+    char **inherited = environ;
+    for (char **env = inherited; *env; env++) {
+        char *equals = strchr(*env, '=');
+        if (!equals || equals == *env) continue;
+
+        size_t len = equals - *env;
+        char name[256];
+        if (len >= sizeof(name)) continue;
+        memcpy(name, *env, len);
+        name[len] = '\0';
+        if (strcmp(name, "PS1") != 0) {
+            export_shell_var(name, equals + 1);
+        }
+    }
     set_shell_var("PS1", "$ ");
-    char *path = getenv("PATH");
-    if (path) set_shell_var("PATH", path);
-    char *home = getenv("HOME");
-    if (home) set_shell_var("HOME", home);
-    char *user = getenv("USER");
-    if (user) set_shell_var("USER", user);
-    
-    // Load history
+}
+
+// Everything only an interactive session needs: history, the SIGCHLD
+// wakeup for the prompt loop, and the terminal. Scripts and -c skip it.
+void init_interactive(void) {
     load_history();
-    
-    // Set up job control
-    setpgid(0, 0);
+    init_job_control();
+    enable_job_control();
 }
 
 void cleanup_shell(void) {
     save_history();
     
     // Free history
-    for (int i = 0; i < history_count; i++) {
-        free(history[i]);
-    }
+    free_history();
     
-    // Free aliases
-    for (int i = 0; i < alias_count; i++) {
-        free(aliases[i].name);
-        free(aliases[i].value);
-    }
+    // Free aliases and variables
+    hash_table_clear(&alias_table, free);
+    free_shell_vars();
     
-    // Free variables
-    for (int i = 0; i < var_count; i++) {
-        free(shell_vars[i].name);
-        free(shell_vars[i].value);
-    }
+    hash_invalidate();
+    free_functions();
+    free_completion();
+    free_arithmetic();
     
     // Free job list
-    job_t *current = job_list;
-    while (current) {
-        job_t *next = current->next;
-        free(current->command);
-        free(current);
-        current = next;
-    }
-}
-
-char *read_line(void) {
-    char *line = NULL;
-    size_t bufsize = 0;
-    
-    if (getline(&line, &bufsize, stdin) == -1) {
-        if (feof(stdin)) {
-            return NULL;  // EOF
-        } else {
-            perror("readline");
-            exit(EXIT_FAILURE);
-        }
-    }
-    
-    // Remove trailing newline
-    size_t len = strlen(line);
-    if (len > 0 && line[len-1] == '\n') {
-        line[len-1] = '\0';
-    }
-    
-    return line;
+    free_jobs();
 }
 
 char **split_line(char *line) {
@@ -109,29 +92,7 @@ char **split_line(char *line) {
     return tokens;
 }
 
-void display_prompt(void) {
-    char cwd[1024];
-    char *ps1 = get_shell_var("PS1");
-    char *user = get_shell_var("USER");
-    char hostname[256];
-    
-    if (gethostname(hostname, sizeof(hostname)) != 0) {
-        strcpy(hostname, "unknown");
-    }
-    
-    if (getcwd(cwd, sizeof(cwd)) == NULL) {
-        strcpy(cwd, "unknown");
-    }
-    
-    // Simple prompt with colors
-    printf("%s%s@%s%s:%s%s%s %s", 
-           COLOR_GREEN, user ? user : "user",
-           hostname,
-           COLOR_RESET,
-           COLOR_BLUE, cwd,
-           COLOR_RESET,
-           ps1 ? ps1 : "$ ");
-}
+static int run_command(char **args);
 
 int execute_command(char **args) {
     if (args[0] == NULL) {
@@ -140,72 +101,63 @@ int execute_command(char **args) {
     
     // Check for alias
     char *alias_value = get_alias(args[0]);
-    if (alias_value) {
-        // Replace first argument with alias value
-        char *expanded = malloc(strlen(alias_value) + 1);
-        strcpy(expanded, alias_value);
-        
-        // Split alias and prepend to args
-        char **alias_args = split_line(expanded);
-        
-        // Create new args array with alias expanded
-        int alias_count = 0;
-        while (alias_args[alias_count]) alias_count++;
-        
-        int original_count = 0;
-        while (args[original_count]) original_count++;
-        
-        char **new_args = malloc((alias_count + original_count) * sizeof(char*));
-        
-        // Copy alias args
-        for (int i = 0; i < alias_count; i++) {
-            new_args[i] = alias_args[i];
-        }
-        
-        // Copy remaining original args (skip first)
-        for (int i = 1; i < original_count; i++) {
-            new_args[alias_count + i - 1] = args[i];
-        }
-        new_args[alias_count + original_count - 1] = NULL;
-        
-        free(expanded);
-        free(alias_args);
-        args = new_args;
+    if (!alias_value) {
+        return run_command(args);
     }
     
-    // Built-in commands
-    if (strcmp(args[0], "cd") == 0) return cmd_cd(args);
-    if (strcmp(args[0], "pwd") == 0) return cmd_pwd(args);
-    if (strcmp(args[0], "exit") == 0) return cmd_exit(args);
-    if (strcmp(args[0], "help") == 0) return cmd_help(args);
-    if (strcmp(args[0], "history") == 0) return cmd_history(args);
-    if (strcmp(args[0], "jobs") == 0) return cmd_jobs(args);
-    if (strcmp(args[0], "fg") == 0) return cmd_fg(args);
-    if (strcmp(args[0], "bg") == 0) return cmd_bg(args);
-    if (strcmp(args[0], "kill") == 0) return cmd_kill(args);
-    if (strcmp(args[0], "export") == 0) return cmd_export(args);
-    if (strcmp(args[0], "unset") == 0) return cmd_unset(args);
-    if (strcmp(args[0], "alias") == 0) return cmd_alias(args);
-    if (strcmp(args[0], "unalias") == 0) return cmd_unalias(args);
-    if (strcmp(args[0], "echo") == 0) return cmd_echo(args);
-    if (strcmp(args[0], "type") == 0) return cmd_type(args);
+    // Split alias value and splice it in place of the first argument
+    char *expanded = strdup(alias_value);
+    char **alias_args = split_line(expanded);
+    free(expanded);
     
-    // External command
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child process
-        if (execvp(args[0], args) == -1) {
-            printf("%s: command not found\n", args[0]);
+    int alias_count = 0;
+    while (alias_args[alias_count]) alias_count++;
+    
+    int original_count = 0;
+    while (args[original_count]) original_count++;
+    
+    char **new_args = malloc((alias_count + original_count) * sizeof(char*));
+    
+    // Copy alias args
+    for (int i = 0; i < alias_count; i++) {
+        new_args[i] = alias_args[i];
+    }
+    
+    // Copy remaining original args (skip first)
+    for (int i = 1; i < original_count; i++) {
+        new_args[alias_count + i - 1] = args[i];
+    }
+    new_args[alias_count + original_count - 1] = NULL;
+    
+    int result = new_args[0] ? run_command(new_args) : 1;
+    
+    free_args(alias_args);
+    free(new_args);
+    return result;
+}
+
+// Run a builtin or external command, after alias substitution
+static int run_command(char **args) {
+    // Functions
+    shell_function_t *fn = find_function(args[0]);
+    if (fn) return call_function(fn, args);
+    
+    // Built-in commands
+    const builtin_t *builtin = find_builtin(args[0]);
+    if (builtin) {
+        if (!(builtin->flags & BUILTIN_KEEPS_STATUS)) {
+            last_exit_status = 0;
         }
-        exit(EXIT_FAILURE);
-    } else if (pid < 0) {
-        perror("fork");
-    } else {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);
+        return builtin->handler(args);
     }
     
+    // External command
+    spawn_req_t req;
+    spawn_req_init(&req, args);
+    char *text = join_words(args);
+    last_exit_status = run_in_foreground(&req, text ? text : args[0]);
+    free(text);
+    
     return 1;
 }
 
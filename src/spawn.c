@@ -0,0 +1,248 @@
+#include "shell.h"
+#include <spawn.h>
+
+// Process launch layer. External commands go through posix_spawn, which
+// glibc implements with clone(CLONE_VM | CLONE_VFORK): the child borrows the
+// shell's address space until it execs, so nothing gets copied no matter how
+// large the shell has grown. Pipes and redirections are expressed as spawn
+// file actions. Only requests carrying a shell_fn (the child has to run shell
+// code rather than a program) fall back to a real fork.
+//
+// Under job control a process joins its job's process group (founding it
+// if it is the first) before it execs, and the first process of a
+// foreground job takes the terminal itself, so it can never touch the tty
+// while still in the background. Signals the shell ignores for job control
+// are reset to their defaults in the child.
+
+static void job_control_signals(sigset_t *set) {
+    sigemptyset(set);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGQUIT);
+    sigaddset(set, SIGTSTP);
+    sigaddset(set, SIGTTIN);
+    sigaddset(set, SIGTTOU);
+    sigaddset(set, SIGCHLD);
+}
+
+void spawn_req_init(spawn_req_t *req, char **argv) {
+    memset(req, 0, sizeof(*req));
+    req->argv = argv;
+    req->in_fd = -1;
+    req->out_fd = -1;
+}
+
+// Open the redirection targets in the parent so that failures are reported
+// with the file name, and so a missing file can't be mistaken for a missing
+// command (posix_spawn reports both as ENOENT).
+int open_redirect_files(const spawn_req_t *req, int *in_fd, int *out_fd) {
+    *in_fd = req->in_fd;
+    *out_fd = req->out_fd;
+
+    if (req->in_file) {
+        *in_fd = open(req->in_file, O_RDONLY | O_CLOEXEC);
+        if (*in_fd == -1) {
+            perror("open input file");
+            return -1;
+        }
+    }
+
+    if (req->out_file) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+        if (req->append) {
+            flags |= O_APPEND;
+        } else {
+            flags |= O_TRUNC;
+        }
+
+        *out_fd = open(req->out_file, flags, 0644);
+        if (*out_fd == -1) {
+            perror("open output file");
+            if (req->in_file) close(*in_fd);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Open the files of redirections beyond stdin and stdout, and copy every
+// source to a descriptor of 10 or more, so that placing one never
+// overwrites another still to be placed. fds gets one entry per
+// redirection; close them with close_fd_redirects.
+int open_fd_redirects(const fd_redirects_t *redirs, int *fds) {
+    int count = redirs ? redirs->count : 0;
+
+    for (int i = 0; i < count; i++) {
+        const fd_redirect_t *redir = &redirs->list[i];
+        int fd = redir->source;
+        if (redir->file) {
+            fd = open(redir->file, redir->flags | O_CLOEXEC, 0644);
+            if (fd == -1) {
+                perror(redir->file);
+                while (i-- > 0) {
+                    if (fds[i] != -1) close(fds[i]);
+                }
+                return -1;
+            }
+        }
+        fds[i] = fd == -1 ? -1 : fcntl(fd, F_DUPFD_CLOEXEC, 10);
+        if (redir->file) close(fd);
+    }
+    return 0;
+}
+
+void close_fd_redirects(const fd_redirects_t *redirs, int *fds) {
+    int count = redirs ? redirs->count : 0;
+    for (int i = 0; i < count; i++) {
+        if (fds[i] != -1) close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+static void close_redirections(const spawn_req_t *req, int in_fd, int out_fd) {
+    if (req->in_file && in_fd != -1) close(in_fd);
+    if (req->out_file && out_fd != -1) close(out_fd);
+}
+
+// Fork fallback: the child runs shell code instead of exec'ing a program.
+static pid_t spawn_fork(const spawn_req_t *req, int in_fd, int out_fd, const int *fds) {
+    pid_t pid = fork();
+
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    } else if (pid == 0) {
+        if (req->job && job_control) {
+            setpgid(0, req->job->pgid);
+            if (req->job->foreground && !req->job->pgid) {
+                tcsetpgrp(STDIN_FILENO, getpgrp());
+            }
+            sigset_t set;
+            job_control_signals(&set);
+            for (int sig = 1; sig < NSIG; sig++) {
+                if (sigismember(&set, sig)) signal(sig, SIG_DFL);
+            }
+            // The subshell runs its commands in this job's group
+            job_control = 0;
+        } else {
+            // Not a job: stay in the shell's group, keeping the stop
+            // signals ignored, and don't start jobs of its own
+            signal(SIGINT, SIG_DFL);
+            signal(SIGCHLD, SIG_DFL);
+            job_control = 0;
+        }
+        if (in_fd != -1) dup2(in_fd, STDIN_FILENO);
+        if (out_fd != -1) dup2(out_fd, STDOUT_FILENO);
+        for (int i = 0; req->fd_redirects && i < req->fd_redirects->count; i++) {
+            if (fds[i] != -1) dup2(fds[i], req->fd_redirects->list[i].fd);
+        }
+        for (int i = 0; i < req->nclose; i++) {
+            close(req->close_fds[i]);
+        }
+
+        int status = req->shell_fn(req->shell_arg);
+        fflush(stdout);
+        _exit(status);
+    }
+
+    return pid;
+}
+
+pid_t spawn_process(const spawn_req_t *req) {
+    int in_fd, out_fd;
+    int fds[MAX_REDIRECT_FD + 1];
+
+    // Anything still buffered belongs before the child's output
+    fflush(stdout);
+
+    if (open_redirect_files(req, &in_fd, &out_fd) == -1) {
+        return -1;
+    }
+    if (open_fd_redirects(req->fd_redirects, fds) == -1) {
+        close_redirections(req, in_fd, out_fd);
+        return -1;
+    }
+
+    if (req->shell_fn) {
+        pid_t pid = spawn_fork(req, in_fd, out_fd, fds);
+        close_redirections(req, in_fd, out_fd);
+        close_fd_redirects(req->fd_redirects, fds);
+        if (pid > 0 && req->job) job_add_process(req->job, pid);
+        return pid;
+    }
+
+    // All shell-side descriptors are O_CLOEXEC, so the only actions needed
+    // are the dup2s onto stdin/stdout and any other redirected descriptors
+    // (dup2 clears close-on-exec on the copy).
+    // File actions run in order, and taking the terminal has to happen
+    // while stdin is still the terminal, so that one goes first.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    if (req->job && job_control) {
+        sigset_t defaults;
+        job_control_signals(&defaults);
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        posix_spawnattr_setpgroup(&attr, req->job->pgid);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+        if (req->job->foreground && !req->job->pgid) {
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+        }
+#endif
+    }
+    if (in_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+    if (out_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+    for (int i = 0; req->fd_redirects && i < req->fd_redirects->count; i++) {
+        if (fds[i] == -1) continue;
+        posix_spawn_file_actions_adddup2(&actions, fds[i], req->fd_redirects->list[i].fd);
+    }
+
+    // Resolve through the command hash; an unknown command is reported
+    // here without creating a process at all.
+    pid_t pid = -1;
+    int err = ENOENT;
+    const char *path = find_command(req->argv[0]);
+    if (path) {
+        err = posix_spawn(&pid, path, &actions, &attr, req->argv, shell_envp());
+        if (err == ENOENT && path != req->argv[0]) {
+            // Stale entry: the binary went away since it was hashed
+            hash_forget_command(req->argv[0]);
+            path = find_command(req->argv[0]);
+            if (path) {
+                err = posix_spawn(&pid, path, &actions, &attr, req->argv, shell_envp());
+            }
+        }
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close_redirections(req, in_fd, out_fd);
+    close_fd_redirects(req->fd_redirects, fds);
+
+    if (!path) {
+        fprintf(stderr, "%s: command not found\n", req->argv[0]);
+        return -1;
+    }
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", req->argv[0], strerror(err));
+        return -1;
+    }
+
+    if (req->job) job_add_process(req->job, pid);
+    return pid;
+}
+
+int open_pipe(int fds[2]) {
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    return 0;
+}
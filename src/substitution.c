@@ -0,0 +1,172 @@
+#include "shell.h"
+#include <sys/mman.h>
+
+// Command substitution: $(...) and `...`.
+//
+// The text is parsed again on its own, then run one of two ways. Commands
+// that only write output (pure builtins such as echo and pwd, and functions
+// made of nothing else) run in the shell itself with stdout pointed at a
+// memfd, which can take any amount of output without a reader, so no
+// process is created at all. Anything else runs in a forked subshell whose
+// stdout is a pipe, read in large chunks into a buffer that doubles as it
+// fills. Trailing newlines are removed from the result either way.
+
+#define SUBST_READ_CHUNK 65536
+#define SUBST_MAX_DEPTH 16      // function calls followed when judging purity
+
+static int is_pure_node(node_t *node, int depth);
+
+// A simple command naming a pure builtin, or a function whose body is pure
+static int is_pure_command(node_t *cmd, int depth) {
+    char *name = cmd->words[0];
+    if (!name || cmd->redirects) return 0;
+
+    // A word whose expansion could assign is expanded in a subshell
+    for (int i = 0; cmd->words[i]; i++) {
+        if (expansion_assigns(cmd->words[i])) return 0;
+    }
+
+    // A name that needs expanding can't be judged before it runs
+    if (strpbrk(name, "$`'\"\\*?[")) return 0;
+    if (get_alias(name)) return 0;
+
+    shell_function_t *fn = find_function(name);
+    if (fn) {
+        return depth < SUBST_MAX_DEPTH && is_pure_node(function_body(fn), depth + 1);
+    }
+
+    const builtin_t *builtin = find_builtin(name);
+    return builtin && (builtin->flags & BUILTIN_PURE);
+}
+
+static int is_pure_node(node_t *node, int depth) {
+    switch (node->type) {
+    case NODE_COMMAND:
+        return is_pure_command(node, depth);
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_SEQUENCE:
+        return is_pure_node(node->left, depth) && is_pure_node(node->right, depth);
+    case NODE_GROUP:
+        return is_pure_node(node->left, depth);
+    default:
+        return 0;
+    }
+}
+
+// Run in the shell with stdout on a memfd, then take the output back in
+// one read. NULL, without running anything, if no memfd can be had.
+static char *capture_in_process(node_t *root, size_t *len) {
+    int fd = memfd_create("substitution", MFD_CLOEXEC);
+    if (fd == -1) return NULL;
+
+    fflush(stdout);
+    int saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(fd, STDOUT_FILENO);
+
+    execute_node(root);
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    clearerr(stdout);
+
+    struct stat st;
+    char *output = NULL;
+    if (fstat(fd, &st) == 0 && (output = malloc(st.st_size + 1))) {
+        ssize_t got = pread(fd, output, st.st_size, 0);
+        *len = got > 0 ? (size_t)got : 0;
+        output[*len] = '\0';
+    }
+    close(fd);
+    return output ? output : strdup("");
+}
+
+// Wait for a subshell that isn't a job. Nothing else reaps it: the SIGCHLD
+// reaper only runs from the main loop, between commands.
+static int wait_for_subshell(pid_t pid) {
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) == -1) {
+        if (errno != EINTR) return 0;
+    }
+    account_child_usage(current_timing(), &usage);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Run in a forked subshell and read its stdout until it closes. The
+// subshell is not a job: it stays in the shell's process group without
+// taking the terminal and, like the shell, ignores the keyboard stop
+// signals, so Ctrl-Z can't leave the shell blocked on a stopped writer.
+static char *capture_from_child(node_t *root, size_t *len) {
+    int fds[2];
+    if (open_pipe(fds) == -1) return NULL;
+
+    spawn_req_t req;
+    spawn_req_init(&req, NULL);
+    req.shell_fn = run_node_in_child;
+    req.shell_arg = root;
+    req.out_fd = fds[1];
+    req.close_fds = &fds[0];
+    req.nclose = 1;
+
+    pid_t pid = spawn_process(&req);
+    close(fds[1]);
+
+    size_t capacity = SUBST_READ_CHUNK;
+    char *output = malloc(capacity);
+    *len = 0;
+    while (output && pid != -1) {
+        if (capacity - *len < SUBST_READ_CHUNK) {
+            capacity *= 2;
+            char *grown = realloc(output, capacity);
+            if (!grown) break;
+            output = grown;
+        }
+        ssize_t got = read(fds[0], output + *len, capacity - *len - 1);
+        if (got == -1 && errno == EINTR) continue;
+        if (got <= 0) break;
+        *len += got;
+    }
+    close(fds[0]);
+    if (output) output[*len] = '\0';
+
+    last_exit_status = pid == -1 ? 127 : wait_for_subshell(pid);
+    return output;
+}
+
+// Run code and return what it wrote to stdout, minus trailing newlines.
+// Sets $? to the command's status. The result is malloc'd, with its length
+// in *len.
+char *command_substitution(const char *code, size_t *len) {
+    int status;
+    parse_tree_t *tree = parse_command_line(code, &status);
+    char *output = NULL;
+    *len = 0;
+
+    if (status == PARSE_INCOMPLETE) {
+        fprintf(stderr, "shell: syntax error: unexpected end of command substitution\n");
+    }
+    if (!tree) {
+        last_exit_status = 2;
+    } else if (!tree->root) {
+        last_exit_status = 0;
+    } else {
+        if (is_pure_node(tree->root, 0)) {
+            output = capture_in_process(tree->root, len);
+        }
+        if (!output) {
+            output = capture_from_child(tree->root, len);
+        }
+    }
+    free_parse_tree(tree);
+
+    if (!output) {
+        *len = 0;
+        return strdup("");
+    }
+    while (*len > 0 && output[*len - 1] == '\n') {
+        output[--(*len)] = '\0';
+    }
+    return output;
+}
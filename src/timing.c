@@ -0,0 +1,197 @@
+#include "shell.h"
+#include <math.h>
+#include <sys/time.h>
+
+// Measuring commands: the `time` reserved word and the bench builtin.
+//
+// Every child the shell reaps is collected with wait4. Jobs remember which
+// `time` run started them, and only their processes' resource usage (which
+// includes the descendants they waited for) is added to a running total
+// here; a background job that happens to be reaped while a command is timed
+// doesn't count. `time` compares the totals before and after the pipeline,
+// plus the shell's own usage for anything that ran in-process.
+// Peak RSS can't be subtracted, so it is tracked as a high-water mark that
+// `time` resets for the duration of its pipeline.
+
+#define BENCH_DEFAULT_RUNS 10
+
+typedef struct usage_totals {
+    struct timeval utime;
+    struct timeval stime;
+    long maxrss;            // KB, largest single child
+    long nvcsw;
+    long nivcsw;
+} usage_totals_t;
+
+static usage_totals_t children;
+static unsigned long timing_serial;     // last `time` run started
+static unsigned long timing_base;       // outermost one still running, or 0
+
+// The `time` run that processes started now belong to, or 0
+unsigned long current_timing(void) {
+    return timing_base ? timing_serial : 0;
+}
+
+// Add a reaped child's usage if it was started by a `time` still running
+void account_child_usage(unsigned long timing, const struct rusage *usage) {
+    if (!timing_base || timing < timing_base) {
+        return;
+    }
+    timeradd(&children.utime, &usage->ru_utime, &children.utime);
+    timeradd(&children.stime, &usage->ru_stime, &children.stime);
+    if (usage->ru_maxrss > children.maxrss) {
+        children.maxrss = usage->ru_maxrss;
+    }
+    children.nvcsw += usage->ru_nvcsw;
+    children.nivcsw += usage->ru_nivcsw;
+}
+
+static double timespec_seconds(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Seconds between two timevals, summed over the children and the shell
+static double cpu_seconds(const struct timeval *child_start, const struct timeval *child_end,
+                          const struct timeval *self_start, const struct timeval *self_end) {
+    struct timeval child, self;
+    timersub(child_end, child_start, &child);
+    timersub(self_end, self_start, &self);
+    return child.tv_sec + self.tv_sec + (child.tv_usec + self.tv_usec) / 1e6;
+}
+
+static void print_time(const char *label, double seconds) {
+    int minutes = (int)(seconds / 60);
+    fprintf(stderr, "%s\t%dm%.3fs\n", label, minutes, seconds - minutes * 60);
+}
+
+int execute_timed(node_t *node) {
+    usage_totals_t before = children;
+    struct rusage self_start, self_end;
+    struct timespec start, end;
+
+    int outermost = !timing_base;
+    timing_serial++;
+    if (outermost) timing_base = timing_serial;
+
+    children.maxrss = 0;
+    getrusage(RUSAGE_SELF, &self_start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int status = node ? execute_node(node) : 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &self_end);
+    if (outermost) timing_base = 0;
+    long peak = children.maxrss;
+    if (before.maxrss > children.maxrss) {
+        children.maxrss = before.maxrss;
+    }
+
+    fflush(stdout);
+    fprintf(stderr, "\n");
+    print_time("real", timespec_seconds(&start, &end));
+    print_time("user", cpu_seconds(&before.utime, &children.utime,
+                                   &self_start.ru_utime, &self_end.ru_utime));
+    print_time("sys", cpu_seconds(&before.stime, &children.stime,
+                                  &self_start.ru_stime, &self_end.ru_stime));
+    fprintf(stderr, "maxrss\t%ld KB\n", peak);
+    fprintf(stderr, "ctxsw\t%ld voluntary, %ld involuntary\n",
+            children.nvcsw - before.nvcsw + self_end.ru_nvcsw - self_start.ru_nvcsw,
+            children.nivcsw - before.nivcsw + self_end.ru_nivcsw - self_start.ru_nivcsw);
+
+    last_exit_status = status;
+    return status;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const double *sorted, int count, double pct) {
+    int rank = (int)ceil(pct / 100.0 * count);
+    if (rank < 1) rank = 1;
+    return sorted[rank - 1];
+}
+
+static void print_ms(const char *label, double seconds) {
+    fprintf(stderr, "  %-8s%10.3f ms\n", label, seconds * 1000);
+}
+
+// bench [-n N] command [args]: run a command N times and report the
+// distribution of its wall-clock time
+int cmd_bench(char **args) {
+    int runs = BENCH_DEFAULT_RUNS;
+    int i = 1;
+
+    if (args[i] && strncmp(args[i], "-n", 2) == 0) {
+        const char *count = args[i][2] ? args[i] + 2 : args[++i];
+        runs = count ? atoi(count) : 0;
+        if (runs <= 0) {
+            printf("bench: -n needs a positive number\n");
+            last_exit_status = 1;
+            return 1;
+        }
+        i++;
+    }
+    if (!args[i]) {
+        printf("Usage: bench [-n N] command [args]\n");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    char **command = args + i;
+    double *samples = malloc(runs * sizeof(double));
+    if (!samples) {
+        perror("bench");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    int done = 0;
+    int failed = 0;
+    int keep_going = 1;
+    while (done < runs) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        keep_going = execute_command(command);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        samples[done++] = timespec_seconds(&start, &end);
+        if (last_exit_status != 0) failed++;
+        // Stop on Ctrl-C or exit rather than carrying on regardless
+        if (!keep_going || exit_requested || last_exit_status == 128 + SIGINT) break;
+    }
+
+    qsort(samples, done, sizeof(double), compare_doubles);
+
+    double sum = 0;
+    for (int j = 0; j < done; j++) sum += samples[j];
+    double mean = sum / done;
+    double variance = 0;
+    for (int j = 0; j < done; j++) {
+        variance += (samples[j] - mean) * (samples[j] - mean);
+    }
+    double stddev = done > 1 ? sqrt(variance / (done - 1)) : 0;
+
+    char *text = join_words(command);
+    fflush(stdout);
+    fprintf(stderr, "bench: %d run%s of %s", done, done == 1 ? "" : "s", text ? text : command[0]);
+    if (failed) fprintf(stderr, " (%d failed)", failed);
+    fprintf(stderr, "\n");
+    free(text);
+
+    print_ms("min", samples[0]);
+    print_ms("median", done % 2 ? samples[done / 2]
+                                : (samples[done / 2 - 1] + samples[done / 2]) / 2);
+    print_ms("mean", mean);
+    print_ms("stddev", stddev);
+    print_ms("p95", percentile(samples, done, 95));
+    print_ms("p99", percentile(samples, done, 99));
+    print_ms("max", samples[done - 1]);
+
+    free(samples);
+    last_exit_status = failed ? 1 : 0;
+    return keep_going;
+}
@@ -1,4 +1,5 @@
 #include "shell.h"
+#include <sys/sendfile.h>
 
 char *trim_whitespace(char *str) {
     if (!str) return NULL;
@@ -19,18 +20,7 @@ char *trim_whitespace(char *str) {
 }
 
 int is_builtin(char *command) {
-    char *builtins[] = {
-        "cd", "pwd", "exit", "help", "history", "jobs", 
-        "fg", "bg", "kill", "export", "unset", "alias", 
-        "unalias", "echo", "type", NULL
-    };
-    
-    for (int i = 0; builtins[i]; i++) {
-        if (strcmp(command, builtins[i]) == 0) {
-            return 1;
-        }
-    }
-    return 0;
+    return find_builtin(command) != NULL;
 }
 
 // String utilities
@@ -83,7 +73,63 @@ char *str_replace(const char *orig, const char *rep, const char *with) {
     return result;
 }
 
+// Join a NULL-terminated word list with single spaces
+char *join_words(char **words) {
+    size_t len = 1;
+    for (int i = 0; words[i]; i++) {
+        len += strlen(words[i]) + 1;
+    }
+
+    char *text = malloc(len);
+    if (!text) return NULL;
+    char *dst = text;
+    *dst = '\0';
+    for (int i = 0; words[i]; i++) {
+        if (i > 0) *dst++ = ' ';
+        size_t word_len = strlen(words[i]);
+        memcpy(dst, words[i], word_len + 1);
+        dst += word_len;
+    }
+    return text;
+}
+
+// qsort comparator for arrays of strings
+int compare_strings(const void *a, const void *b) {
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
 // File utilities
+// Move everything from in_fd to out_fd. sendfile keeps the data in the
+// kernel; anything it can't handle falls back to read/write.
+int copy_fd(int in_fd, int out_fd) {
+    for (;;) {
+        ssize_t n = sendfile(out_fd, in_fd, NULL, 1 << 30);
+        if (n == 0) return 0;
+        if (n > 0) continue;
+        if (errno == EINTR) continue;
+        if (errno != EINVAL && errno != ENOSYS) return -1;
+        break;
+    }
+    
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(in_fd, buf, sizeof(buf))) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t w = write(out_fd, buf + done, n - done);
+            if (w == -1) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            done += w;
+        }
+    }
+    return 0;
+}
+
 int file_exists(const char *filename) {
     struct stat buffer;
     return (stat(filename, &buffer) == 0);
@@ -106,27 +152,8 @@ char *get_full_path(const char *command) {
         return strdup(command);
     }
     
-    char *path_env = getenv("PATH");
-    if (!path_env) return NULL;
-    
-    char *path_copy = strdup(path_env);
-    char *dir = strtok(path_copy, ":");
-    
-    while (dir) {
-        char *full_path = malloc(strlen(dir) + strlen(command) + 2);
-        sprintf(full_path, "%s/%s", dir, command);
-        
-        if (is_executable(full_path)) {
-            free(path_copy);
-            return full_path;
-        }
-        
-        free(full_path);
-        dir = strtok(NULL, ":");
-    }
-    
-    free(path_copy);
-    return NULL;
+    const char *path = find_command(command);
+    return path ? strdup(path) : NULL;
 }
 
 // Process utilities